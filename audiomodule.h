@@ -4,15 +4,38 @@
 // A library that works with various serial audio modules,
 // like DFPlayer Mini, Catalex, etc.
 
+#pragma once
+
+#include "audioobserver.h"
+#include "framedmessage.h"
+#include "mediainventory.h"
 #include "timeout.h"
 
+// The observer is chosen when the module is compiled, so a sketch that
+// wants a different one defines this before including the header.
+#ifndef AUDIO_OBSERVER
+#define AUDIO_OBSERVER VerboseAudioObserver
+#endif
+
 class BasicAudioModule {
   public:
     explicit BasicAudioModule(Stream &stream) :
-      m_stream(stream), m_in(), m_out(), m_state(nullptr), m_timeout() {}
+      m_stream(stream), m_in(), m_out(), m_state(ST_IDLE), m_timeout(),
+      m_pending_head(0), m_pending_count(0), m_timeouts(0),
+      m_inventory(nullptr), m_inventory_address(0), m_devices(0), m_cached(false) {}
 
     virtual void begin() { reset(); }
 
+    // Remembers what's on the storage devices in EEPROM at `address` (see
+    // mediainventory.h), so later startups can skip most of the queries
+    // when the same card is inserted.  It takes up
+    // `MediaInventory::eeprom_size()` bytes from there.  Call before
+    // `begin`.
+    void useInventoryCache(MediaInventory &cache, int address = 0) {
+      m_inventory = &cache;
+      m_inventory_address = address;
+    }
+
     // Call each time through `loop`.
     void update() {
       checkForIncomingMessage();
@@ -39,7 +62,13 @@ class BasicAudioModule {
     // 
     // Resetting causes an unavoidable click on the output.
     void reset() {
-      setState(&s_init_resetting_hardware);
+      // Anything still waiting to be sent is moot once the module resets.
+      m_pending_count = 0;
+      m_timeout.cancel();
+      // setState does nothing if the state doesn't change, so a reset
+      // during initialization has to leave the current state first.
+      m_state = ST_IDLE;
+      setState(ST_INIT_RESETTING_HARDWARE);
     }
 
     // Select a Device to be the current source.
@@ -242,6 +271,10 @@ class BasicAudioModule {
     // to this query, so watch for a timeout error.
     void queryFirmwareVersion() { sendQuery(MID_FIRMWAREVERSION); }
 
+    // The number of times the module failed to reply to a command in
+    // time, counting each retry.
+    uint16_t timeouts() const { return m_timeouts; }
+
     static constexpr uint16_t combine(uint8_t hi, uint8_t lo) {
       return static_cast<uint16_t>(hi << 8) | lo;
     }
@@ -331,226 +364,39 @@ class BasicAudioModule {
       EC_SDCARDERROR        = 0x08,  // ??
       EC_ENTEREDSLEEP       = 0x0A,  // entered sleep mode??
 
-      // And reserving one for our state machine
-      EC_TIMEDOUT           = 0x0100
+      // And reserving some for our own use
+      EC_TIMEDOUT           = 0x0100,
+      EC_QUEUEFULL          = 0x0101   // too many commands awaiting replies
     };
   
-    // Manages a buffered message with all the protocol details.
-    class Message {
-      public:
-        enum { START = 0x7E, VERSION = 0xFF, LENGTH = 6, END = 0xEF };
-        enum Feedback { NO_FEEDBACK = 0x00, FEEDBACK = 0x01 };
-
-        Message() :
-          m_buf{START, VERSION, LENGTH, 0, FEEDBACK, 0, 0, 0, 0, END},
-          m_length(0) {}
-
-        void set(MsgID msgid, uint16_t param, Feedback feedback = NO_FEEDBACK) {
-          // Note that we're filling in just the bytes that change.  We rely
-          // on the framing bytes set when the buffer was first initialized.
-          m_buf[3] = msgid;
-          m_buf[4] = feedback;
-          m_buf[5] = (param >> 8) & 0xFF;
-          m_buf[6] = (param     ) & 0xFF;
-          const uint16_t checksum = ~sum() + 1;
-          m_buf[7] = (checksum >> 8) & 0xFF;
-          m_buf[8] = (checksum     ) & 0xFF;
-          m_length = 10;
-        }
-
-        const uint8_t *getBuffer() const { return m_buf; }
-        int getLength() const { return m_length; }
-
-        bool isValid() const {
-          if (m_length == 8 && m_buf[7] == END) return true;
-          if (m_length != 10) return false;
-          const uint16_t checksum = combine(m_buf[7], m_buf[8]);
-          return sum() + checksum == 0;
-        }
-
-        MsgID getMessageID() const { return static_cast<MsgID>(m_buf[3]); }
-        uint8_t getParamHi() const { return m_buf[5]; }
-        uint8_t getParamLo() const { return m_buf[6]; }
-        uint16_t getParam() const { return combine(m_buf[5], m_buf[6]); }
-
-        // Returns true if the byte `b` completes a message.
-        bool receive(uint8_t b) {
-          switch (m_length) {
-            default:
-              // `m_length` is out of bounds, so start fresh.
-              m_length = 0;
-              /* FALLTHROUGH */
-            case 0: case 1: case 2: case 9:
-              // These bytes must always match the template.
-              if (b == m_buf[m_length]) { ++m_length; return m_length == 10; }
-              // No match; try to resync.
-              if (b == START) { m_length = 1; return false; }
-              m_length = 0;
-              return false;
-            case 7:
-              // If there's no checksum, the message may end here.
-              if (b == END) { m_length = 8; return true; }
-              /* FALLTHROUGH */
-            case 3: case 4: case 5: case 6: case 8:
-              // These are the payload bytes we care about.
-              m_buf[m_length++] = b;
-              return false;
-          }
-        }
-
-      private:
-        // Sums the bytes used to compute the Message's checksum.
-        uint16_t sum() const {
-          uint16_t s = 0;
-          for (int i = 1; i <= LENGTH; ++i) {
-            s += m_buf[i];
-          }
-          return s;
-        }
-
-        uint8_t m_buf[10];
-        int m_length;
-    };
-
-#if 0
-    void onDeviceInserted(Device src) {}
-    void onDeviceRemoved(Device src) {}
-    void onError(uint16_t code) {}
-    void onFinishedFile(Device device, uint16_t file_index) {}
-    void onMessageInvalid() {}
-    void onMessageReceived(const Message &msg) {}
-    void onMessageSent(const uint8_t *buf, int len) {}
-#else
-    void onAck() {
-      Serial.println(F("ACK"));
-    }
-
-    void onCurrentTrack(Device device, uint16_t file_index) {
-      printDeviceName(device);
-      Serial.print(F(" current file index: "));
-      Serial.println(file_index);
-    }
-
-    void onDeviceInserted(Device src) {
-      Serial.print(F("Device inserted: "));
-      printDeviceName(src);
-      Serial.println();
-    }
-
-    void onDeviceRemoved(Device src) {
-      printDeviceName(src);
-      Serial.println(F(" removed."));
-    }
-
-    void onEqualizer(Equalizer eq) {
-      Serial.print(F("Equalizer: "));
-      printEqualizerName(eq);
-      Serial.println();
-    }
-
-    void onError(uint16_t code) {
-      Serial.print(F("Error "));
-      Serial.print(code);
-      Serial.print(F(": "));
-      switch (code) {
-        case 0x00: Serial.println(F("Unsupported command")); break;
-        case 0x01: Serial.println(F("Module busy or no sources available")); break;
-        case 0x02: Serial.println(F("Module sleeping")); break;
-        case 0x03: Serial.println(F("Serial communication error")); break;
-        case 0x04: Serial.println(F("Bad checksum")); break;
-        case 0x05: Serial.println(F("File index out of range")); break;
-        case 0x06: Serial.println(F("Track not found")); break;
-        case 0x07: Serial.println(F("Insertion error")); break;
-        case 0x08: Serial.println(F("SD card error")); break;
-        case 0x0A: Serial.println(F("Entered sleep mode")); break;
-        case 0x100: Serial.println(F("Timed out")); break;
-        default:   Serial.println(F("Unknown error code")); break;
-      }
-    }
-
-    void onDeviceFileCount(Device device, uint16_t count) {
-      printDeviceName(device);
-      Serial.print(F(" file count: "));
-      Serial.println(count);
-    }
-
-    // Note that this hook receives a file index, even if the track
-    // was initialized using something other than its file index.
-    //
-    // The module sometimes sends these multiple times in quick
-    // succession.
-    //
-    // This hook does not trigger when the playback is stopped, only
-    // when a track finishes playing on its own.
-    //
-    // This hook does not trigger when an inserted track finishes.
-    // If you need to know that, you can try watching for a brief
-    // blink on the BUSY pin of the DF Player Mini.
-    void onFinishedFile(Device device, uint16_t file_index) {
-      Serial.print(F("Finished playing file: "));
-      printDeviceName(device);
-      Serial.print(F(" "));
-      Serial.println(file_index);
-    }
-
-    void onFirmwareVersion(uint16_t version) {
-      Serial.print(F("Firmware Version: "));
-      Serial.println(version);
-    }
-
-    void onFolderCount(uint16_t count) {
-      Serial.print(F("Folder count: "));
-      Serial.println(count);
-    }
-
-    void onFolderTrackCount(uint16_t count) {
-      Serial.print(F("Folder track count: "));
-      Serial.println(count);
-    }
-
-    void onInitComplete(uint8_t devices) {
-      Serial.print(F("Hardware initialization complete.  Device(s) online:"));
-      if (devices & (1u << DEV_SDCARD)) Serial.print(F(" SD Card"));
-      if (devices & (1u << DEV_USB))    Serial.print(F(" USB"));
-      if (devices & (1u << DEV_AUX))    Serial.print(F(" AUX"));
-      if (devices & (1u << DEV_FLASH))  Serial.print(F(" Flash"));
-      Serial.println();
-    }
+    // The framing is shared with other serial protocols, so it lives in
+    // framedmessage.h.
+    typedef FramedMessage<MsgID> Message;
 
-    void onMessageInvalid() {
-      Serial.println(F("Invalid message received."));
-    }
-
-    void onMessageReceived(const Message &msg) {
-#if 0
-      const auto *buf = msg.getBuffer();
-      const auto len = msg.getLength();
-      Serial.print(F("Received:"));
-      for (int i = 0; i < len; ++i) {
-        Serial.print(F(" "));
-        Serial.print(buf[i], HEX);
-      }
-      Serial.println();
-#endif
+    // See audioobserver.h.
+    typedef AUDIO_OBSERVER<BasicAudioModule> Observer;
 
+    // Decodes a valid message from the module for the observer.
+    void notifyObserver(const Message &msg) {
+      Observer::onMessageReceived(msg.getBuffer(), msg.getLength());
       switch (msg.getMessageID()) {
         case 0x3A: {
           const auto mask = msg.getParamLo();
-          if (mask & 0x01) onDeviceInserted(DEV_USB);
-          if (mask & 0x02) onDeviceInserted(DEV_SDCARD);
-          if (mask & 0x04) onDeviceInserted(DEV_AUX);
+          if (mask & 0x01) Observer::onDeviceInserted(DEV_USB);
+          if (mask & 0x02) Observer::onDeviceInserted(DEV_SDCARD);
+          if (mask & 0x04) Observer::onDeviceInserted(DEV_AUX);
           return;
         }
         case 0x3B: {
           const auto mask = msg.getParamLo();
-          if (mask & 0x01) onDeviceRemoved(DEV_USB);
-          if (mask & 0x02) onDeviceRemoved(DEV_SDCARD);
-          if (mask & 0x04) onDeviceRemoved(DEV_AUX);
+          if (mask & 0x01) Observer::onDeviceRemoved(DEV_USB);
+          if (mask & 0x02) Observer::onDeviceRemoved(DEV_SDCARD);
+          if (mask & 0x04) Observer::onDeviceRemoved(DEV_AUX);
           return;
         }
-        case 0x3C: return onFinishedFile(DEV_USB, msg.getParam());
-        case 0x3D: return onFinishedFile(DEV_SDCARD, msg.getParam());
-        case 0x3E: return onFinishedFile(DEV_FLASH, msg.getParam());
+        case 0x3C: return Observer::onFinishedFile(DEV_USB, msg.getParam());
+        case 0x3D: return Observer::onFinishedFile(DEV_SDCARD, msg.getParam());
+        case 0x3E: return Observer::onFinishedFile(DEV_FLASH, msg.getParam());
 
         // Initialization complete
         case 0x3F: {
@@ -560,14 +406,14 @@ class BasicAudioModule {
           if (mask & 0x02) devices = devices | (1u << DEV_SDCARD);
           if (mask & 0x04) devices = devices | (1u << DEV_AUX);
           if (mask & 0x10) devices = devices | (1u << DEV_FLASH);
-          return onInitComplete(devices);
+          return Observer::onInitComplete(devices);
         }
 
-        case 0x40: return onError(msg.getParamLo());
+        case 0x40: return Observer::onError(msg.getParamLo());
         
         // ACK
         case 0x41:
-          return onAck();
+          return Observer::onAck();
 
         // Query responses
         case 0x42: {
@@ -587,303 +433,208 @@ class BasicAudioModule {
             case 0x01: state = MS_PLAYING;  break;
             case 0x02: state = MS_PAUSED;   break;
           }
-          return onStatus(device, state);
+          return Observer::onStatus(device, state);
         }
-        case 0x43: return onVolume(msg.getParamLo());
-        case 0x44: return onEqualizer(static_cast<Equalizer>(msg.getParamLo()));
-        case 0x45: return onPlaybackSequence(static_cast<Sequence>(msg.getParamLo()));
-        case 0x46: return onFirmwareVersion(msg.getParam());
-        case 0x47: return onDeviceFileCount(DEV_USB, msg.getParam());
-        case 0x48: return onDeviceFileCount(DEV_SDCARD, msg.getParam());
-        case 0x49: return onDeviceFileCount(DEV_FLASH, msg.getParam());
-        case 0x4B: return onCurrentTrack(DEV_USB, msg.getParam());
-        case 0x4C: return onCurrentTrack(DEV_SDCARD, msg.getParam());
-        case 0x4D: return onCurrentTrack(DEV_FLASH, msg.getParam());
-        case 0x4E: return onFolderTrackCount(msg.getParam());
-        case 0x4F: return onFolderCount(msg.getParam());
+        case 0x43: return Observer::onVolume(msg.getParamLo());
+        case 0x44: return Observer::onEqualizer(static_cast<Equalizer>(msg.getParamLo()));
+        case 0x45: return Observer::onPlaybackSequence(static_cast<Sequence>(msg.getParamLo()));
+        case 0x46: return Observer::onFirmwareVersion(msg.getParam());
+        case 0x47: return Observer::onDeviceFileCount(DEV_USB, msg.getParam());
+        case 0x48: return Observer::onDeviceFileCount(DEV_SDCARD, msg.getParam());
+        case 0x49: return Observer::onDeviceFileCount(DEV_FLASH, msg.getParam());
+        case 0x4B: return Observer::onCurrentTrack(DEV_USB, msg.getParam());
+        case 0x4C: return Observer::onCurrentTrack(DEV_SDCARD, msg.getParam());
+        case 0x4D: return Observer::onCurrentTrack(DEV_FLASH, msg.getParam());
+        case 0x4E: return Observer::onFolderTrackCount(msg.getParam());
+        case 0x4F: return Observer::onFolderCount(msg.getParam());
         default: break;
       }
     }
 
-    void onMessageSent(const uint8_t * /* buf */, int /* len */) {
-#if 0
-      Serial.print(F("Sent:    "));
-      for (int i = 0; i < len; ++i) {
-        Serial.print(F(" "));
-        Serial.print(buf[i], HEX);
+  private:
+    // The State tells us how to handle messages received from the module.
+    // Rather than a class hierarchy with a vtable per state (which lives in
+    // RAM on AVR), the states are just numbers, and their behavior is
+    // described by a table of transitions in program memory.
+    enum State : uint8_t {
+      // There's no operation in progress, so the user can make a new
+      // request.
+      ST_IDLE,
+      ST_INIT_RESETTING_HARDWARE,
+      ST_INIT_CHECKING_CACHE,
+      ST_INIT_GETTING_VERSION,
+      ST_INIT_CHECKING_USB_FILE_COUNT,
+      ST_INIT_CHECKING_SD_FILE_COUNT,
+      ST_INIT_SELECTING_USB,
+      ST_INIT_SELECTING_SD,
+      ST_INIT_CHECKING_FOLDER_COUNT,
+      ST_INIT_START_PLAYING
+    };
+
+    // An Action performs the side effects of a transition and returns the
+    // new State.  It can return the current State to remain there, ST_IDLE
+    // to indicate that the operation is complete, or another State in
+    // order to chain a series of operations together.
+    typedef State (*Action)(BasicAudioModule *module, uint8_t paramHi, uint8_t paramLo);
+
+    // When `state` receives `msgid`, we call `action`, if there is one, or
+    // else go straight to `next`.  Messages a state doesn't list leave it
+    // where it is.  MID_ENTERSTATE is the event for entering the state.
+    struct Transition {
+      State  state;
+      MsgID  msgid;
+      State  next;
+      Action action;
+    };
+    static constexpr uint8_t TRANSITION_COUNT = 24;
+    static const Transition s_transitions[TRANSITION_COUNT];
+
+    State onEvent(MsgID msgid, uint8_t paramHi, uint8_t paramLo) {
+      for (uint8_t i = 0; i < TRANSITION_COUNT; ++i) {
+        Transition t;
+        memcpy_P(&t, &s_transitions[i], sizeof(t));
+        if (t.state != m_state || t.msgid != msgid) continue;
+        return t.action ? t.action(this, paramHi, paramLo) : t.next;
       }
-      Serial.println();
-#endif
+      return m_state;
     }
 
-    void onPlaybackSequence(Sequence seq) {
-      Serial.print(F("Playback Sequence: "));
-      printSequenceName(seq);
-      Serial.println();
+    static State resetHardware(BasicAudioModule *module, uint8_t, uint8_t) {
+      Observer::onResetting();
+      // The default timeout is probably too short for a reset.
+      module->sendCommand(MID_RESET, 0, false, 10000);
+      return ST_INIT_RESETTING_HARDWARE;
     }
-    
-    void onStatus(Device device, ModuleState state) {
-      Serial.print(F("State: "));
-      if (device != DEV_SLEEP) {
-        printDeviceName(device);
-        Serial.print(F(" "));
+
+    static State resetFailed(BasicAudioModule *, uint8_t paramHi, uint8_t paramLo) {
+      if (combine(paramHi, paramLo) == EC_TIMEDOUT) {
+        Observer::onNoResponse();
+      }
+      return ST_IDLE;
+    }
+
+    // If the same devices are online as last time, we check whether the
+    // selected one still has the same number of files.  If it does, we
+    // trust the rest of the cached inventory.
+    static State initComplete(BasicAudioModule *module, uint8_t, uint8_t paramLo) {
+      module->m_devices = paramLo;
+      module->m_cached = false;
+      auto *cache = module->m_inventory;
+      if (cache == nullptr) return ST_INIT_GETTING_VERSION;
+      if (!(cache->load_from_eeprom(module->m_inventory_address) && cache->sane())) {
+        return ST_INIT_GETTING_VERSION;
       }
-      printModuleStateName(state);
-      Serial.println();
+      if (cache->devices() != paramLo) return ST_INIT_GETTING_VERSION;
+      const auto source = static_cast<Device>(cache->source());
+      if (source != DEV_USB && source != DEV_SDCARD) return ST_INIT_GETTING_VERSION;
+      module->m_source = source;
+      return ST_INIT_CHECKING_CACHE;
     }
 
-    void onVolume(uint8_t volume) {
-      Serial.print(F("Volume: "));
-      Serial.println(volume);
+    static State checkCachedFileCount(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->queryFileCount(module->m_source);
+      return ST_INIT_CHECKING_CACHE;
     }
 
-    void printDeviceName(Device src) {
-      switch (src) {
-        case DEV_USB:    Serial.print(F("USB")); break;
-        case DEV_SDCARD: Serial.print(F("SD Card")); break;
-        case DEV_AUX:    Serial.print(F("AUX")); break;
-        case DEV_SLEEP:  Serial.print(F("SLEEP (does this make sense)")); break;
-        case DEV_FLASH:  Serial.print(F("FLASH")); break;
-        default:         Serial.print(F("Unknown Device")); break;
-      }
+    static State gotCachedFileCount(BasicAudioModule *module, uint8_t paramHi, uint8_t paramLo) {
+      const auto *cache = module->m_inventory;
+      const auto files = combine(paramHi, paramLo);
+      if (files != cache->files()) return ST_INIT_GETTING_VERSION;
+      module->m_files = files;
+      module->m_folders = cache->folders();
+      module->m_cached = true;
+      return module->m_source == DEV_USB ? ST_INIT_SELECTING_USB : ST_INIT_SELECTING_SD;
     }
 
-    void printEqualizerName(Equalizer eq) {
-      switch (eq) {
-        case EQ_NORMAL:    Serial.print(F("Normal"));    break;
-        case EQ_POP:       Serial.print(F("Pop"));       break;
-        case EQ_ROCK:      Serial.print(F("Rock"));      break;
-        case EQ_JAZZ:      Serial.print(F("Jazz"));      break;
-        case EQ_CLASSICAL: Serial.print(F("Classical")); break;
-        case EQ_BASS:      Serial.print(F("Bass"));      break;
-        default:           Serial.print(F("Unknown EQ")); break;
-      }
+    static State getVersion(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->queryFirmwareVersion();
+      return ST_INIT_GETTING_VERSION;
     }
 
-    void printModuleStateName(ModuleState state) {
-      switch (state) {
-        case MS_STOPPED: Serial.print(F("Stopped")); break;
-        case MS_PLAYING: Serial.print(F("Playing")); break;
-        case MS_PAUSED:  Serial.print(F("Paused"));  break;
-        case MS_ASLEEP:  Serial.print(F("Asleep"));  break;
-        default:         Serial.print(F("???"));     break;
+    static State getVersionFailed(BasicAudioModule *, uint8_t paramHi, uint8_t paramLo) {
+      // Catalex doesn't respond to this query, so a timeout isn't fatal.
+      if (combine(paramHi, paramLo) == EC_TIMEDOUT) {
+        return ST_INIT_CHECKING_USB_FILE_COUNT;
       }
+      return ST_INIT_GETTING_VERSION;
     }
 
-    void printSequenceName(Sequence seq) {
-      switch (seq) {
-        case SEQ_LOOPALL:    Serial.print(F("Loop All")); break;
-        case SEQ_LOOPFOLDER: Serial.print(F("Loop Folder")); break;
-        case SEQ_LOOPTRACK:  Serial.print(F("Loop Track")); break;
-        case SEQ_RANDOM:     Serial.print(F("Random")); break;
-        case SEQ_SINGLE:     Serial.print(F("Single")); break;
-        default:             Serial.print(F("???")); break;
-      }
+    static State checkUSBFileCount(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->queryFileCount(DEV_USB);
+      return ST_INIT_CHECKING_USB_FILE_COUNT;
     }
-#endif
 
-  private:
-    // The State tells us how to handle messages received from the module.
-    // The intent is to have one static instance of each concrete State in
-    // order to minimize RAM and ROM usage.
-    struct State {
-        // The return value is a pointer to the new State.  You can return
-        // `this` to remain in the same State, `nullptr` to indicate that
-        // the operation is complete and the user can make a new request,
-        // or a pointer to another State in order to chain a series of
-        // operations together.
-        virtual State *onEvent(
-          BasicAudioModule * /*module*/,
-          MsgID /*msgid*/,
-          uint8_t /*paramHi*/,
-          uint8_t /*paramLo*/
-        ) {
-          return this;
-        }
-    };
+    static State gotUSBFileCount(BasicAudioModule *module, uint8_t paramHi, uint8_t paramLo) {
+      module->m_files = combine(paramHi, paramLo);
+      if (module->m_files > 0) return ST_INIT_SELECTING_USB;
+      return ST_INIT_CHECKING_SD_FILE_COUNT;
+    }
 
-    struct InitResettingHardware : public State {
-      State *onEvent(
-          BasicAudioModule *module,
-          MsgID msgid,
-          uint8_t paramHi,
-          uint8_t paramLo
-      ) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            Serial.println(F("Resetting hardware."));
-            module->sendCommand(MID_RESET, 0, false);
-            // The default timeout is probably too short for a reset.
-            module->m_timeout.set(10000);
-            return this;
-          case MID_INITCOMPLETE:
-            return &BasicAudioModule::s_init_getting_version;
-          case MID_ERROR:
-            if (combine(paramHi, paramLo) == EC_TIMEDOUT) {
-              Serial.println(F("No response from audio module"));
-            }
-            return nullptr;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitResettingHardware s_init_resetting_hardware;
-
-    struct InitGettingVersion : public State {
-      State *onEvent(BasicAudioModule *module, MsgID msgid, uint8_t paramHi, uint8_t paramLo) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->queryFirmwareVersion();
-            return this;
-          case MID_FIRMWAREVERSION:
-            return &s_init_checking_usb_file_count;
-          case MID_ERROR:
-            if (combine(paramHi, paramLo) == EC_TIMEDOUT) {
-              return &s_init_checking_usb_file_count;
-            }
-            break;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitGettingVersion s_init_getting_version;
-
-    struct InitCheckingUSBFileCount : public State {
-      State *onEvent(BasicAudioModule *module, MsgID msgid, uint8_t paramHi, uint8_t paramLo) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->queryFileCount(BasicAudioModule::DEV_USB);
-            return this;
-          case MID_USBFILECOUNT: {
-            const auto count = (static_cast<uint16_t>(paramHi) << 8) | paramLo;
-            module->m_files = count;
-            if (count > 0) return &s_init_selecting_usb;
-            return &s_init_checking_sd_file_count;
-          }
-          case MID_ERROR:
-            return &s_init_checking_sd_file_count;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitCheckingUSBFileCount s_init_checking_usb_file_count;
-    
-    struct InitCheckingSDFileCount : public State {
-      State *onEvent(BasicAudioModule *module, MsgID msgid, uint8_t paramHi, uint8_t paramLo) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->queryFileCount(BasicAudioModule::DEV_SDCARD);
-            return this;
-          case MID_SDFILECOUNT: {
-            const auto count = (static_cast<uint16_t>(paramHi) << 8) | paramLo;
-            module->m_files = count;
-            if (count > 0) return &s_init_selecting_sd;
-            return nullptr;
-          }
-          case MID_ERROR:
-            return nullptr;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitCheckingSDFileCount s_init_checking_sd_file_count;
-
-    struct InitSelectingUSB : public State {
-      State *onEvent(
-        BasicAudioModule *module,
-        MsgID msgid,
-        uint8_t /*paramHi*/,
-        uint8_t /*paramLo*/
-      ) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->selectSource(BasicAudioModule::DEV_USB);
-            return this;
-          case MID_ACK:
-            module->m_source = BasicAudioModule::DEV_USB;
-            return &s_init_checking_folder_count;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitSelectingUSB s_init_selecting_usb;
-
-    struct InitSelectingSD : public State {
-      State *onEvent(
-        BasicAudioModule *module,
-        MsgID msgid,
-        uint8_t /*paramHi*/,
-        uint8_t /*paramLo*/
-      ) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->selectSource(BasicAudioModule::DEV_SDCARD);
-            return this;
-          case MID_ACK:
-            module->m_source = BasicAudioModule::DEV_SDCARD;
-            return &s_init_checking_folder_count;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitSelectingSD s_init_selecting_sd;
-
-    struct InitCheckingFolderCount : public State {
-      State *onEvent(
-        BasicAudioModule *module,
-        MsgID msgid,
-        uint8_t /*paramHi*/,
-        uint8_t paramLo
-      ) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->queryFolderCount();
-            return this;
-          case MID_FOLDERCOUNT:
-            module->m_folders = paramLo;
-            Serial.print(F("Audio module initialized.\nSelected: "));
-            module->printDeviceName(module->m_source);
-            Serial.print(F(" with "));
-            Serial.print(module->m_files);
-            Serial.print(F(" files and "));
-            Serial.print(module->m_folders);
-            Serial.println(F(" folders"));
-            return nullptr;
-          default: break;
-        }
-        return this;
-      }
-    };
-    static InitCheckingFolderCount s_init_checking_folder_count;
-
-    struct InitStartPlaying : public State {
-      State *onEvent(
-        BasicAudioModule *module,
-        MsgID msgid,
-        uint8_t /*paramHi*/,
-        uint8_t /*paramLo*/
-      ) override {
-        switch (msgid) {
-          case MID_ENTERSTATE:
-            module->sendCommand(MID_LOOPFOLDER, 1);
-            return this;
-          case MID_ACK:
-            return nullptr;
-          default: break;
-        }
-        return this;
+    static State checkSDFileCount(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->queryFileCount(DEV_SDCARD);
+      return ST_INIT_CHECKING_SD_FILE_COUNT;
+    }
+
+    static State gotSDFileCount(BasicAudioModule *module, uint8_t paramHi, uint8_t paramLo) {
+      module->m_files = combine(paramHi, paramLo);
+      if (module->m_files > 0) return ST_INIT_SELECTING_SD;
+      return ST_IDLE;
+    }
+
+    static State selectUSB(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->selectSource(DEV_USB);
+      return ST_INIT_SELECTING_USB;
+    }
+
+    static State selectedUSB(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->m_source = DEV_USB;
+      if (module->m_cached) return ready(module);
+      return ST_INIT_CHECKING_FOLDER_COUNT;
+    }
+
+    static State selectSD(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->selectSource(DEV_SDCARD);
+      return ST_INIT_SELECTING_SD;
+    }
+
+    static State selectedSD(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->m_source = DEV_SDCARD;
+      if (module->m_cached) return ready(module);
+      return ST_INIT_CHECKING_FOLDER_COUNT;
+    }
+
+    static State checkFolderCount(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->queryFolderCount();
+      return ST_INIT_CHECKING_FOLDER_COUNT;
+    }
+
+    static State gotFolderCount(BasicAudioModule *module, uint8_t, uint8_t paramLo) {
+      module->m_folders = paramLo;
+      if (auto *cache = module->m_inventory) {
+        cache->record(module->m_devices, module->m_source, module->m_files, module->m_folders);
+        // This writes only if something has changed.
+        cache->save_to_eeprom(module->m_inventory_address);
       }
-    };
-    static InitStartPlaying s_init_start_playing;
+      return ready(module);
+    }
+
+    static State ready(BasicAudioModule *module) {
+      Observer::onReady(module->m_source, module->m_files, module->m_folders);
+      return ST_IDLE;
+    }
+
+    static State startPlaying(BasicAudioModule *module, uint8_t, uint8_t) {
+      module->sendCommand(MID_LOOPFOLDER, 1);
+      return ST_INIT_START_PLAYING;
+    }
 
     void checkForIncomingMessage() {
-      while (m_stream.available() > 0) {
+      // A burst of chatter from the module (e.g., repeated "finished"
+      // notifications) shouldn't stall `loop`, so we read a limited number
+      // of bytes per call.  Anything left over waits in the serial buffer,
+      // and the decoder picks up where it left off next time.
+      for (uint8_t budget = RECEIVE_BUDGET; budget > 0; --budget) {
+        if (m_stream.available() <= 0) return;
         if (m_in.receive(m_stream.read())) {
           receiveMessage(m_in);
         }
@@ -893,30 +644,82 @@ class BasicAudioModule {
     void checkForTimeout() {
       if (m_timeout.expired()) {
         m_timeout.cancel();
-        if (m_state) {
-          setState(m_state->onEvent(this, MID_ERROR, high(EC_TIMEDOUT), low(EC_TIMEDOUT)));
+        if (m_timeouts < 0xFFFF) ++m_timeouts;
+        if (m_pending_count > 0) {
+          auto &head = m_pending[m_pending_head];
+          if (head.retries > 0) {
+            --head.retries;
+            return sendHead();
+          }
+          popHead();
+        }
+        if (m_state != ST_IDLE) {
+          setState(onEvent(MID_ERROR, high(EC_TIMEDOUT), low(EC_TIMEDOUT)));
+        } else {
+          Observer::onError(EC_TIMEDOUT);
         }
       }
     }
 
     void receiveMessage(const Message &msg) {
-      onMessageReceived(msg);
-      if (!msg.isValid()) return onMessageInvalid();
-      if (!m_state) return;
-      setState(m_state->onEvent(this, msg.getMessageID(), msg.getParamHi(), msg.getParamLo()));
+      if (!msg.isValid()) return Observer::onMessageInvalid();
+      notifyObserver(msg);
+      if (m_pending_count > 0 && isReplyTo(msg.getMessageID(), m_pending[m_pending_head].msgid)) {
+        m_timeout.cancel();
+        popHead();
+      }
+      if (m_state == ST_IDLE) return;
+      setState(onEvent(msg.getMessageID(), msg.getParamHi(), msg.getParamLo()));
+    }
+
+    // Replies are the ACK, an error, or a query response.  The
+    // asynchronous notifications don't count, except that the
+    // init-complete notification is the reply to a reset.
+    static bool isReplyTo(MsgID reply, MsgID request) {
+      if (MID_ERROR <= reply && reply <= MID_FOLDERCOUNT) return true;
+      return request == MID_RESET && reply == MID_INITCOMPLETE;
     }
 
-    void sendMessage(const Message &msg) {
+    void sendMessage(const Message &msg, uint16_t timeout) {
       const auto buf = msg.getBuffer();
       const auto len = msg.getLength();
       m_stream.write(buf, len);
-      m_timeout.set(200);
-      onMessageSent(buf, len);
-    }
-
-    void sendCommand(MsgID msgid, uint16_t param = 0, bool feedback = true) {
-      m_out.set(msgid, param, feedback ? Message::FEEDBACK : Message::NO_FEEDBACK);
-      sendMessage(m_out);
+      m_timeout.set(timeout);
+      Observer::onMessageSent(buf, len);
+    }
+
+    // Commands are queued so that each one is sent only after the module
+    // has replied to the previous one (or we've given up waiting).  The
+    // next command goes out as soon as the reply arrives.
+    void sendCommand(
+      MsgID msgid,
+      uint16_t param = 0,
+      bool feedback = true,
+      uint16_t timeout = 200
+    ) {
+      if (m_pending_count == PENDING_SIZE) return Observer::onError(EC_QUEUEFULL);
+      auto &entry = m_pending[(m_pending_head + m_pending_count) % PENDING_SIZE];
+      entry.msgid = msgid;
+      entry.feedback = feedback;
+      // A command that asked for an ACK and didn't get one was probably
+      // lost or garbled, so it's worth resending.  A query with no reply
+      // may just be unsupported (e.g., Catalex and the firmware version),
+      // so we don't hold things up by retrying it.
+      entry.retries = feedback ? MAX_RETRIES : 0;
+      entry.param = param;
+      entry.timeout = timeout;
+      if (++m_pending_count == 1) sendHead();
+    }
+
+    void sendHead() {
+      const auto &head = m_pending[m_pending_head];
+      m_out.set(head.msgid, head.param, head.feedback ? Message::FEEDBACK : Message::NO_FEEDBACK);
+      sendMessage(m_out, head.timeout);
+    }
+
+    void popHead() {
+      m_pending_head = (m_pending_head + 1) % PENDING_SIZE;
+      if (--m_pending_count > 0) sendHead();
     }
 
     void sendQuery(MsgID msgid, uint16_t param = 0) {
@@ -924,12 +727,12 @@ class BasicAudioModule {
       sendCommand(msgid, param, false);
     }
 
-    void setState(State *new_state, uint8_t arg1 = 0, uint8_t arg2 = 0) {
+    void setState(State new_state, uint8_t arg1 = 0, uint8_t arg2 = 0) {
       const auto original_state = m_state;
       while (m_state != new_state) {
         m_state = new_state;
-        if (m_state) {
-          new_state = m_state->onEvent(this, MID_ENTERSTATE, arg1, arg2);
+        if (m_state != ST_IDLE) {
+          new_state = onEvent(MID_ENTERSTATE, arg1, arg2);
         }
         // break out of a cycle
         if (m_state == original_state) return;
@@ -942,11 +745,32 @@ class BasicAudioModule {
     Stream  &m_stream;
     Message  m_in;
     Message  m_out;
-    State   *m_state;
-    Timeout<MillisClock> m_timeout;
+    State    m_state;
+    Timeout<MillisClock> m_timeout;  // for the command at the head of the queue
+
+    struct PendingCommand {
+      MsgID    msgid;
+      uint8_t  feedback : 1;
+      uint8_t  retries  : 2;
+      uint16_t param;
+      uint16_t timeout;
+    };
+    static constexpr uint8_t RECEIVE_BUDGET = 20;  // two messages' worth
+    static constexpr uint8_t PENDING_SIZE = 6;
+    static constexpr uint8_t MAX_RETRIES = 2;
+    PendingCommand m_pending[PENDING_SIZE];
+    uint8_t  m_pending_head;
+    uint8_t  m_pending_count;
+    uint16_t m_timeouts;
+
     Device   m_source;   // the currently selected device
     uint16_t m_files;    // the number of files on the selected device
     uint8_t  m_folders;  // the number of folders on the selected device
+
+    MediaInventory *m_inventory;
+    int      m_inventory_address;
+    uint8_t  m_devices;  // the online devices, as reported after a reset
+    bool     m_cached;   // whether the inventory came from the cache
 };
 
 template <typename SerialType>
@@ -970,11 +794,30 @@ AudioModule<SerialType> make_AudioModule(SerialType &serial) {
   return AudioModule<SerialType>(serial);
 }
 
-BasicAudioModule::InitResettingHardware    BasicAudioModule::s_init_resetting_hardware;
-BasicAudioModule::InitGettingVersion       BasicAudioModule::s_init_getting_version;
-BasicAudioModule::InitCheckingUSBFileCount BasicAudioModule::s_init_checking_usb_file_count;
-BasicAudioModule::InitCheckingSDFileCount  BasicAudioModule::s_init_checking_sd_file_count;
-BasicAudioModule::InitSelectingUSB         BasicAudioModule::s_init_selecting_usb;
-BasicAudioModule::InitSelectingSD          BasicAudioModule::s_init_selecting_sd;
-BasicAudioModule::InitCheckingFolderCount  BasicAudioModule::s_init_checking_folder_count;
-BasicAudioModule::InitStartPlaying         BasicAudioModule::s_init_start_playing;
+const BasicAudioModule::Transition
+BasicAudioModule::s_transitions[BasicAudioModule::TRANSITION_COUNT] PROGMEM = {
+  { ST_INIT_RESETTING_HARDWARE,      MID_ENTERSTATE,      ST_IDLE,                         resetHardware },
+  { ST_INIT_RESETTING_HARDWARE,      MID_INITCOMPLETE,    ST_IDLE,                         initComplete },
+  { ST_INIT_RESETTING_HARDWARE,      MID_ERROR,           ST_IDLE,                         resetFailed },
+  { ST_INIT_CHECKING_CACHE,          MID_ENTERSTATE,      ST_IDLE,                         checkCachedFileCount },
+  { ST_INIT_CHECKING_CACHE,          MID_USBFILECOUNT,    ST_IDLE,                         gotCachedFileCount },
+  { ST_INIT_CHECKING_CACHE,          MID_SDFILECOUNT,     ST_IDLE,                         gotCachedFileCount },
+  { ST_INIT_CHECKING_CACHE,          MID_ERROR,           ST_INIT_GETTING_VERSION,         nullptr },
+  { ST_INIT_GETTING_VERSION,         MID_ENTERSTATE,      ST_IDLE,                         getVersion },
+  { ST_INIT_GETTING_VERSION,         MID_FIRMWAREVERSION, ST_INIT_CHECKING_USB_FILE_COUNT, nullptr },
+  { ST_INIT_GETTING_VERSION,         MID_ERROR,           ST_IDLE,                         getVersionFailed },
+  { ST_INIT_CHECKING_USB_FILE_COUNT, MID_ENTERSTATE,      ST_IDLE,                         checkUSBFileCount },
+  { ST_INIT_CHECKING_USB_FILE_COUNT, MID_USBFILECOUNT,    ST_IDLE,                         gotUSBFileCount },
+  { ST_INIT_CHECKING_USB_FILE_COUNT, MID_ERROR,           ST_INIT_CHECKING_SD_FILE_COUNT,  nullptr },
+  { ST_INIT_CHECKING_SD_FILE_COUNT,  MID_ENTERSTATE,      ST_IDLE,                         checkSDFileCount },
+  { ST_INIT_CHECKING_SD_FILE_COUNT,  MID_SDFILECOUNT,     ST_IDLE,                         gotSDFileCount },
+  { ST_INIT_CHECKING_SD_FILE_COUNT,  MID_ERROR,           ST_IDLE,                         nullptr },
+  { ST_INIT_SELECTING_USB,           MID_ENTERSTATE,      ST_IDLE,                         selectUSB },
+  { ST_INIT_SELECTING_USB,           MID_ACK,             ST_IDLE,                         selectedUSB },
+  { ST_INIT_SELECTING_SD,            MID_ENTERSTATE,      ST_IDLE,                         selectSD },
+  { ST_INIT_SELECTING_SD,            MID_ACK,             ST_IDLE,                         selectedSD },
+  { ST_INIT_CHECKING_FOLDER_COUNT,   MID_ENTERSTATE,      ST_IDLE,                         checkFolderCount },
+  { ST_INIT_CHECKING_FOLDER_COUNT,   MID_FOLDERCOUNT,     ST_IDLE,                         gotFolderCount },
+  { ST_INIT_START_PLAYING,           MID_ENTERSTATE,      ST_IDLE,                         startPlaying },
+  { ST_INIT_START_PLAYING,           MID_ACK,             ST_IDLE,                         nullptr }
+};
@@ -0,0 +1,288 @@
+// Observers for audio module events
+
+// BasicAudioModule reports everything it hears from the module (finished
+// files, errors, query responses, and so on) by calling static functions
+// on an observer class, which is chosen at compile time.  Because the
+// calls are resolved by the compiler, an observer with empty functions
+// costs nothing at all, and a production build doesn't carry the strings
+// and Serial calls of the diagnostics.
+//
+// An observer is a class template that takes the module type, so it can
+// name the module's enums.  There are three to choose from:
+//
+// * SilentAudioObserver ignores everything.
+// * VerboseAudioObserver prints a description of each event to Serial.
+//   This is the default.
+// * TracingAudioObserver also dumps every message sent and received in
+//   hex.
+//
+// To choose one, define AUDIO_OBSERVER before including audiomodule.h.
+// To react to events, derive from one of these and hide the functions you
+// care about.  Since the observer is defined before the rest of the
+// sketch, it calls functions that are declared ahead of it:
+//
+//     void nextCue();
+//
+//     template <class Module>
+//     struct ShowObserver : public SilentAudioObserver<Module> {
+//       static void onFinishedFile(typename Module::Device, uint16_t) {
+//         nextCue();
+//       }
+//     };
+//
+//     #define AUDIO_OBSERVER ShowObserver
+//     #include "audiomodule.h"
+//
+// The hooks are called from the module's `update`, so they should be
+// quick.
+
+#pragma once
+
+template <class Module>
+struct SilentAudioObserver {
+  typedef typename Module::Device Device;
+  typedef typename Module::Equalizer Equalizer;
+  typedef typename Module::ModuleState ModuleState;
+  typedef typename Module::Sequence Sequence;
+
+  static void onAck() {}
+  static void onCurrentTrack(Device, uint16_t /* file_index */) {}
+  static void onDeviceFileCount(Device, uint16_t /* count */) {}
+  static void onDeviceInserted(Device) {}
+  static void onDeviceRemoved(Device) {}
+  static void onEqualizer(Equalizer) {}
+  static void onError(uint16_t /* code */) {}
+
+  // Note that this hook receives a file index, even if the track
+  // was initialized using something other than its file index.
+  //
+  // The module sometimes sends these multiple times in quick
+  // succession.
+  //
+  // This hook does not trigger when the playback is stopped, only
+  // when a track finishes playing on its own.
+  //
+  // This hook does not trigger when an inserted track finishes.
+  // If you need to know that, you can try watching for a brief
+  // blink on the BUSY pin of the DF Player Mini.
+  static void onFinishedFile(Device, uint16_t /* file_index */) {}
+
+  static void onFirmwareVersion(uint16_t /* version */) {}
+  static void onFolderCount(uint16_t /* count */) {}
+  static void onFolderTrackCount(uint16_t /* count */) {}
+  // `devices` has a bit set for each Device that's online.
+  static void onInitComplete(uint8_t /* devices */) {}
+  static void onMessageInvalid() {}
+  // The module didn't answer the reset at the start of initialization.
+  static void onNoResponse() {}
+  // Called for each valid message, before the more specific hook.
+  static void onMessageReceived(const uint8_t * /* buf */, int /* len */) {}
+  static void onMessageSent(const uint8_t * /* buf */, int /* len */) {}
+  static void onPlaybackSequence(Sequence) {}
+  // Initialization has finished and selected a source.
+  static void onReady(Device /* source */, uint16_t /* files */, uint8_t /* folders */) {}
+  static void onResetting() {}
+  static void onStatus(Device, ModuleState) {}
+  static void onVolume(uint8_t /* volume */) {}
+};
+
+template <class Module>
+struct VerboseAudioObserver : public SilentAudioObserver<Module> {
+  typedef typename Module::Device Device;
+  typedef typename Module::Equalizer Equalizer;
+  typedef typename Module::ModuleState ModuleState;
+  typedef typename Module::Sequence Sequence;
+
+  static void onAck() {
+    Serial.println(F("ACK"));
+  }
+
+  static void onCurrentTrack(Device device, uint16_t file_index) {
+    printDeviceName(device);
+    Serial.print(F(" current file index: "));
+    Serial.println(file_index);
+  }
+
+  static void onDeviceInserted(Device src) {
+    Serial.print(F("Device inserted: "));
+    printDeviceName(src);
+    Serial.println();
+  }
+
+  static void onDeviceRemoved(Device src) {
+    printDeviceName(src);
+    Serial.println(F(" removed."));
+  }
+
+  static void onEqualizer(Equalizer eq) {
+    Serial.print(F("Equalizer: "));
+    printEqualizerName(eq);
+    Serial.println();
+  }
+
+  static void onError(uint16_t code) {
+    Serial.print(F("Error "));
+    Serial.print(code);
+    Serial.print(F(": "));
+    switch (code) {
+      case 0x00: Serial.println(F("Unsupported command")); break;
+      case 0x01: Serial.println(F("Module busy or no sources available")); break;
+      case 0x02: Serial.println(F("Module sleeping")); break;
+      case 0x03: Serial.println(F("Serial communication error")); break;
+      case 0x04: Serial.println(F("Bad checksum")); break;
+      case 0x05: Serial.println(F("File index out of range")); break;
+      case 0x06: Serial.println(F("Track not found")); break;
+      case 0x07: Serial.println(F("Insertion error")); break;
+      case 0x08: Serial.println(F("SD card error")); break;
+      case 0x0A: Serial.println(F("Entered sleep mode")); break;
+      case 0x100: Serial.println(F("Timed out")); break;
+      case 0x101: Serial.println(F("Command queue full")); break;
+      default:   Serial.println(F("Unknown error code")); break;
+    }
+  }
+
+  static void onDeviceFileCount(Device device, uint16_t count) {
+    printDeviceName(device);
+    Serial.print(F(" file count: "));
+    Serial.println(count);
+  }
+
+  static void onFinishedFile(Device device, uint16_t file_index) {
+    Serial.print(F("Finished playing file: "));
+    printDeviceName(device);
+    Serial.print(F(" "));
+    Serial.println(file_index);
+  }
+
+  static void onFirmwareVersion(uint16_t version) {
+    Serial.print(F("Firmware Version: "));
+    Serial.println(version);
+  }
+
+  static void onFolderCount(uint16_t count) {
+    Serial.print(F("Folder count: "));
+    Serial.println(count);
+  }
+
+  static void onFolderTrackCount(uint16_t count) {
+    Serial.print(F("Folder track count: "));
+    Serial.println(count);
+  }
+
+  static void onInitComplete(uint8_t devices) {
+    Serial.print(F("Hardware initialization complete.  Device(s) online:"));
+    if (devices & (1u << Module::DEV_SDCARD)) Serial.print(F(" SD Card"));
+    if (devices & (1u << Module::DEV_USB))    Serial.print(F(" USB"));
+    if (devices & (1u << Module::DEV_AUX))    Serial.print(F(" AUX"));
+    if (devices & (1u << Module::DEV_FLASH))  Serial.print(F(" Flash"));
+    Serial.println();
+  }
+
+  static void onMessageInvalid() {
+    Serial.println(F("Invalid message received."));
+  }
+
+  static void onNoResponse() {
+    Serial.println(F("No response from audio module"));
+  }
+
+  static void onPlaybackSequence(Sequence seq) {
+    Serial.print(F("Playback Sequence: "));
+    printSequenceName(seq);
+    Serial.println();
+  }
+
+  static void onReady(Device source, uint16_t files, uint8_t folders) {
+    Serial.print(F("Audio module initialized.\nSelected: "));
+    printDeviceName(source);
+    Serial.print(F(" with "));
+    Serial.print(files);
+    Serial.print(F(" files and "));
+    Serial.print(folders);
+    Serial.println(F(" folders"));
+  }
+
+  static void onResetting() {
+    Serial.println(F("Resetting hardware."));
+  }
+
+  static void onStatus(Device device, ModuleState state) {
+    Serial.print(F("State: "));
+    if (device != Module::DEV_SLEEP) {
+      printDeviceName(device);
+      Serial.print(F(" "));
+    }
+    printModuleStateName(state);
+    Serial.println();
+  }
+
+  static void onVolume(uint8_t volume) {
+    Serial.print(F("Volume: "));
+    Serial.println(volume);
+  }
+
+  static void printDeviceName(Device src) {
+    switch (src) {
+      case Module::DEV_USB:    Serial.print(F("USB")); break;
+      case Module::DEV_SDCARD: Serial.print(F("SD Card")); break;
+      case Module::DEV_AUX:    Serial.print(F("AUX")); break;
+      case Module::DEV_SLEEP:  Serial.print(F("SLEEP (does this make sense)")); break;
+      case Module::DEV_FLASH:  Serial.print(F("FLASH")); break;
+      default:                 Serial.print(F("Unknown Device")); break;
+    }
+  }
+
+  static void printEqualizerName(Equalizer eq) {
+    switch (eq) {
+      case Module::EQ_NORMAL:    Serial.print(F("Normal"));    break;
+      case Module::EQ_POP:       Serial.print(F("Pop"));       break;
+      case Module::EQ_ROCK:      Serial.print(F("Rock"));      break;
+      case Module::EQ_JAZZ:      Serial.print(F("Jazz"));      break;
+      case Module::EQ_CLASSICAL: Serial.print(F("Classical")); break;
+      case Module::EQ_BASS:      Serial.print(F("Bass"));      break;
+      default:                   Serial.print(F("Unknown EQ")); break;
+    }
+  }
+
+  static void printModuleStateName(ModuleState state) {
+    switch (state) {
+      case Module::MS_STOPPED: Serial.print(F("Stopped")); break;
+      case Module::MS_PLAYING: Serial.print(F("Playing")); break;
+      case Module::MS_PAUSED:  Serial.print(F("Paused"));  break;
+      case Module::MS_ASLEEP:  Serial.print(F("Asleep"));  break;
+      default:                 Serial.print(F("???"));     break;
+    }
+  }
+
+  static void printSequenceName(Sequence seq) {
+    switch (seq) {
+      case Module::SEQ_LOOPALL:    Serial.print(F("Loop All")); break;
+      case Module::SEQ_LOOPFOLDER: Serial.print(F("Loop Folder")); break;
+      case Module::SEQ_LOOPTRACK:  Serial.print(F("Loop Track")); break;
+      case Module::SEQ_RANDOM:     Serial.print(F("Random")); break;
+      case Module::SEQ_SINGLE:     Serial.print(F("Single")); break;
+      default:                     Serial.print(F("???")); break;
+    }
+  }
+};
+
+template <class Module>
+struct TracingAudioObserver : public VerboseAudioObserver<Module> {
+  static void onMessageReceived(const uint8_t *buf, int len) {
+    Serial.print(F("Received:"));
+    printBytes(buf, len);
+  }
+
+  static void onMessageSent(const uint8_t *buf, int len) {
+    Serial.print(F("Sent:    "));
+    printBytes(buf, len);
+  }
+
+  static void printBytes(const uint8_t *buf, int len) {
+    for (int i = 0; i < len; ++i) {
+      Serial.print(F(" "));
+      Serial.print(buf[i], HEX);
+    }
+    Serial.println();
+  }
+};
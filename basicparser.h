@@ -0,0 +1,69 @@
+// Building blocks for parsing text commands
+
+// A derived parser walks a NUL-terminated command with `m_p`, using these
+// helpers for the tokens every prop needs: whitespace, integers, and
+// keywords from a table (see keywords.h).
+//
+//     class MyParser : public BasicParser {
+//       public:
+//         explicit MyParser(const char *buffer) : BasicParser(buffer) {}
+//         ...
+//     };
+
+#pragma once
+
+#include "keywords.h"
+
+class BasicParser {
+  public:
+    explicit BasicParser(const char *buffer = nullptr) : m_p(buffer) {}
+
+    int parseInteger() { return parseSigned<int, unsigned>(); }
+    long parseLong() { return parseSigned<long, unsigned long>(); }
+
+    unsigned parseUnsigned() { return parseDigits<unsigned>(); }
+    unsigned long parseUnsignedLong() { return parseDigits<unsigned long>(); }
+
+    // Skips whitespace and matches the next word against a keyword table.
+    template <typename ID, uint8_t WIDTH, size_t N>
+    ID parseKeywordFrom(
+      const KeywordEntry<ID, WIDTH> (&table)[N],
+      ID unknown,
+      KeywordCase mode = KeywordCase::EXACT
+    ) {
+      SkipWhitespace();
+      return matchKeyword(m_p, table, unknown, mode);
+    }
+
+    bool Advance() { ++m_p; return true; }
+    bool Accept(char ch) { return (*m_p == ch) ? Advance() : false; }
+    bool MatchDigit() const { return '0' <= *m_p && *m_p <= '9'; }
+    void SkipWhitespace() { while (Accept(' ') || Accept('\t')) {} }
+
+  protected:
+    const char *m_p;
+
+  private:
+    // The arithmetic is done in the width the caller asked for, so the
+    // 16-bit versions don't pay for 32-bit multiplies.
+    template <typename T>
+    T parseDigits() {
+      SkipWhitespace();
+      T result = 0;
+      while (MatchDigit()) {
+        result *= 10;
+        result += *m_p - '0';
+        Advance();
+      }
+      return result;
+    }
+
+    template <typename T, typename U>
+    T parseSigned() {
+      SkipWhitespace();
+      const bool neg = Accept('-');
+      if (!neg) Accept('+');
+      const auto result = static_cast<T>(parseDigits<U>());
+      return neg ? -result : result;
+    }
+};
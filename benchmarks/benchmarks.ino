@@ -0,0 +1,196 @@
+// Benchmarks for the hot paths shared by the props
+
+// Flash this to a bare Pro Mini (or any ATmega328P board) and open the
+// serial monitor at 115200 baud.  It times the code that runs on every
+// pass through `loop` or on every byte that arrives, and checks that
+// Timeout handles the clock rolling over, so a change that slows one of
+// them down or breaks it shows up before it's flashed to every prop.
+//
+// Each figure is the average over many calls, from micros(), so it's good
+// to about 4 us divided by the number of calls.  Nothing needs to be
+// connected to the pins.  Note the numbers before and after a change.
+//
+// The sketch also builds for a PC against the mock core in host/ (see
+// CMakeLists.txt), where ctest runs it and fails on any FAILED check.
+
+#define AUDIO_OBSERVER SilentAudioObserver
+
+#include "../fastpin.h"
+#include "../framedmessage.h"
+#include "../parser.h"
+#include "../rotaryencoder.h"
+#include "../timeout.h"
+
+// Swallows everything and never has anything to read, so the audio module
+// never gets a reply.  After its command queue fills, the parser's calls
+// return right away, so the parser benchmarks measure just the parsing.
+class NullStream : public Stream {
+  public:
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t) override { return 1; }
+    using Print::write;
+};
+
+NullStream null_stream;
+BasicAudioModule audio(null_stream);
+auto parser = Parser(audio);
+auto rotary_encoder = make_RotaryEncoder(FastPin<4>(), FastPin<5>());
+
+// A clock the Timeout check can set.  It's 32 bits, like millis() on a
+// board, so it rolls over at the same place in a host build.
+struct BenchClock {
+  static uint32_t now() { return time(); }
+  static uint32_t &time() {
+    static uint32_t value = 0;
+    return value;
+  }
+};
+
+// Defeats the optimizer, which would otherwise drop work whose result
+// isn't used.
+volatile uint8_t sink;
+
+void printResult(const __FlashStringHelper *name, unsigned long elapsed, unsigned long count) {
+  Serial.print(name);
+  Serial.print(F(": "));
+  if (count == 0) {
+    Serial.println(F("n/a"));
+    return;
+  }
+  // In hundredths of a microsecond, to keep a couple of decimals.
+  const unsigned long centi_us = elapsed * 100 / count;
+  Serial.print(centi_us / 100);
+  Serial.print('.');
+  if (centi_us % 100 < 10) Serial.print('0');
+  Serial.print(centi_us % 100);
+  Serial.println(F(" us"));
+}
+
+// One command per keyword path that the console sees often.
+const char cmd_play[] PROGMEM = "play 3";
+const char cmd_play_folder[] PROGMEM = "play 2/5";
+const char cmd_volume[] PROGMEM = "volume=20";
+const char cmd_eq[] PROGMEM = "eq=rock";
+const char cmd_file_count[] PROGMEM = "sdcard file count?";
+const char cmd_abbreviated[] PROGMEM = "vol?";
+const char cmd_batch[] PROGMEM = "stop; select usb; play 1";
+const char cmd_unknown[] PROGMEM = "frobnicate";
+
+const char *const commands[] PROGMEM = {
+  cmd_play, cmd_play_folder, cmd_volume, cmd_eq, cmd_file_count,
+  cmd_abbreviated, cmd_batch, cmd_unknown
+};
+
+void benchmarkParser() {
+  const unsigned count = 200;
+  char line[32];
+  for (const auto &command : commands) {
+    strcpy_P(line, reinterpret_cast<const char *>(pgm_read_ptr(&command)));
+    const auto start = micros();
+    for (unsigned i = 0; i < count; ++i) sink = parser.parse(line);
+    const auto elapsed = micros() - start;
+    Serial.print(F("parse \""));
+    Serial.print(line);
+    printResult(F("\""), elapsed, count);
+  }
+}
+
+void benchmarkMessage() {
+  FramedMessage<uint8_t> frame;
+  frame.set(0x03, 0x1234, FramedMessage<uint8_t>::FEEDBACK);
+  const uint8_t *bytes = frame.getBuffer();
+  const int length = frame.getLength();
+
+  FramedMessage<uint8_t> decoder;
+  const unsigned frames = 1000;
+  const auto start = micros();
+  for (unsigned i = 0; i < frames; ++i) {
+    for (int j = 0; j < length; ++j) sink = decoder.receive(bytes[j]);
+  }
+  const auto elapsed = micros() - start;
+  sink = decoder.isValid();
+  const unsigned long total = 1ul * frames * length;
+  printResult(F("FramedMessage::receive per byte"), elapsed, total);
+  Serial.print(F("FramedMessage::receive bytes/s: "));
+  // Too fast for the clock to see, which can happen in a host build.
+  if (elapsed == 0) {
+    Serial.println(F("n/a"));
+    return;
+  }
+  // Bytes per millisecond first, since a million times the total would
+  // overflow 32 bits.
+  Serial.println(1000ul * (total * 1000ul / elapsed));
+}
+
+void benchmarkRotaryEncoder() {
+  rotary_encoder.begin();
+  const unsigned count = 1000;
+  const auto start = micros();
+  for (unsigned i = 0; i < count; ++i) sink = rotary_encoder.update();
+  printResult(F("RotaryEncoder::update (polled, idle)"), micros() - start, count);
+}
+
+void checkTimeout(const __FlashStringHelper *name, bool ok) {
+  Serial.print(F("Timeout "));
+  Serial.print(name);
+  Serial.println(ok ? F(": ok") : F(": FAILED"));
+}
+
+void benchmarkTimeout() {
+  Timeout<BenchClock> timeout;
+  auto &now = BenchClock::time();
+
+  // Set just before the clock rolls over, expiring just after.
+  now = 0xFFFFFFF0ul;
+  timeout.set(0x20);
+  checkTimeout(F("waits across rollover"), !timeout.expired());
+  now = 0x00000005ul;
+  checkTimeout(F("still waits after rollover"), !timeout.expired());
+  now = 0x00000010ul;
+  checkTimeout(F("expires after rollover"), timeout.expired());
+
+  // An expiration that lands exactly on 0 is nudged, not lost.
+  now = 0xFFFFFF00ul;
+  timeout.set(0x100);
+  checkTimeout(F("waits for 0"), !timeout.expired());
+  now = 0x00000001ul;
+  checkTimeout(F("expires at 0"), timeout.expired());
+
+  // An expiration just short of the midpoint still comes due once the
+  // clock passes it, though the clock's top bit has changed.
+  now = 0x7FFFFF00ul;
+  timeout.set(0xF0);
+  now = 0x7FFFFFE0ul;
+  checkTimeout(F("waits for the midpoint"), !timeout.expired());
+  now = 0x80000010ul;
+  checkTimeout(F("expires across the midpoint"), timeout.expired());
+
+  timeout.cancel();
+  checkTimeout(F("cancels"), !timeout.expired());
+
+  Timeout<MicrosClock> real;
+  real.set(1000000ul);
+  const unsigned count = 1000;
+  const auto start = micros();
+  for (unsigned i = 0; i < count; ++i) sink = real.expired();
+  printResult(F("Timeout::expired (pending)"), micros() - start, count);
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println(F("Benchmarks"));
+  // Let the serial port drain so it doesn't interrupt the timing.
+  Serial.flush();
+  benchmarkParser();
+  Serial.flush();
+  benchmarkMessage();
+  Serial.flush();
+  benchmarkRotaryEncoder();
+  Serial.flush();
+  benchmarkTimeout();
+  Serial.println(F("Done."));
+}
+
+void loop() {}
@@ -0,0 +1,140 @@
+// Binary command mode
+
+// A host, like a PC running the show or a master controller, can send
+// commands as compact frames instead of text lines.  The frames use the
+// same format as the audio modules (see framedmessage.h), and the audio
+// opcodes are the audio chips' own message IDs and parameters, so a cue
+// costs ten bytes and no parsing.
+//
+// If a frame asks for feedback, we reply with an ACK frame.  A frame we
+// can't handle always gets an ERROR frame, whose parameter says why.
+//
+// The text command "binary" switches to this mode and replies with an ACK
+// frame, so the host knows when to start sending frames.  The TEXTMODE
+// opcode switches back.
+//
+// Query results from the audio module are still reported as text by its
+// notification hooks, so the binary mode omits the queries.
+
+#pragma once
+
+#include "audiomodule.h"
+#include "fogger.h"
+#include "framedmessage.h"
+
+class BinaryCommands {
+  public:
+    enum Opcode : uint8_t {
+      // These match the audio module's message IDs.
+      BC_PLAYNEXT       = 0x01,
+      BC_PLAYPREVIOUS   = 0x02,
+      BC_PLAYFILE       = 0x03,  // param: file index
+      BC_SETVOLUME      = 0x06,  // param: 0 - 30
+      BC_SELECTEQ       = 0x07,  // param: BasicAudioModule::Equalizer
+      BC_SELECTSOURCE   = 0x09,  // param: 1 = USB, 2 = SD card, 5 = flash
+      BC_RESET          = 0x0C,
+      BC_UNPAUSE        = 0x0D,
+      BC_PAUSE          = 0x0E,
+      BC_PLAYFROMFOLDER = 0x0F,  // param: folder (high byte), track (low byte)
+      BC_STOP           = 0x16,
+      BC_RANDOMPLAY     = 0x18,
+
+      // Replies, also as in the audio module's protocol
+      BC_ERROR          = 0x40,  // param: ErrorCode
+      BC_ACK            = 0x41,
+
+      // Our own
+      BC_FOG            = 0x60,  // param: milliseconds
+      BC_TEXTMODE       = 0x7F
+    };
+
+    enum ErrorCode : uint16_t {
+      EC_UNSUPPORTED    = 0x00,  // unknown opcode or bad parameter
+      EC_BADCHECKSUM    = 0x04
+    };
+
+    BinaryCommands(Stream &stream, BasicAudioModule &audio, FogMachine *fogger = nullptr) :
+      m_stream(stream), m_audio(audio), m_fogger(fogger), m_active(false) {}
+
+    void activate() {
+      m_active = true;
+      reply(BC_ACK);
+    }
+
+    bool active() const { return m_active; }
+
+    // Call regularly while `active`.  Returns true if there's more input
+    // to handle right away.
+    bool update() {
+      for (uint8_t budget = RECEIVE_BUDGET; budget > 0; --budget) {
+        if (!m_active || m_stream.available() == 0) return false;
+        if (!m_in.receive(m_stream.read())) continue;
+        if (!m_in.isValid()) {
+          reply(BC_ERROR, EC_BADCHECKSUM);
+        } else if (!execute(m_in.getMessageID(), m_in.getParam())) {
+          reply(BC_ERROR, EC_UNSUPPORTED);
+        } else if (m_in.wantsFeedback()) {
+          reply(BC_ACK);
+        }
+      }
+      return m_active && m_stream.available() > 0;
+    }
+
+  private:
+    typedef FramedMessage<Opcode> Message;
+
+    // Enough for a frame and a half, so a steady stream of commands
+    // doesn't monopolize the loop.
+    static constexpr uint8_t RECEIVE_BUDGET = 16;
+
+    bool execute(Opcode opcode, uint16_t param) {
+      using Audio = BasicAudioModule;
+      switch (opcode) {
+        case BC_PLAYNEXT:       m_audio.playNextFile(); return true;
+        case BC_PLAYPREVIOUS:   m_audio.playPreviousFile(); return true;
+        case BC_PLAYFILE:       m_audio.playFile(param); return true;
+        case BC_SETVOLUME:      m_audio.setVolume(param); return true;
+        case BC_SELECTEQ:
+          if (param > Audio::EQ_BASS) return false;
+          m_audio.selectEQ(static_cast<Audio::Equalizer>(param));
+          return true;
+        case BC_SELECTSOURCE:
+          switch (param) {
+            case 1: m_audio.selectSource(Audio::DEV_USB); return true;
+            case 2: m_audio.selectSource(Audio::DEV_SDCARD); return true;
+            case 5: m_audio.selectSource(Audio::DEV_FLASH); return true;
+            default: return false;
+          }
+        case BC_RESET:          m_audio.reset(); return true;
+        case BC_UNPAUSE:        m_audio.unpause(); return true;
+        case BC_PAUSE:          m_audio.pause(); return true;
+        case BC_PLAYFROMFOLDER:
+          m_audio.playTrack(Audio::high(param), Audio::low(param));
+          return true;
+        case BC_STOP:           m_audio.stop(); return true;
+        case BC_RANDOMPLAY:     m_audio.playFilesInRandomOrder(); return true;
+        case BC_FOG:
+          if (!m_fogger) return false;
+          m_fogger->on(param);
+          return true;
+        case BC_TEXTMODE:
+          // Whatever follows is text, so we stop reading frames now.
+          m_active = false;
+          return true;
+        default: break;
+      }
+      return false;
+    }
+
+    void reply(Opcode opcode, uint16_t param = 0) {
+      m_out.set(opcode, param);
+      m_stream.write(m_out.getBuffer(), m_out.getLength());
+    }
+
+    Stream &m_stream;
+    BasicAudioModule &m_audio;
+    FogMachine *m_fogger;
+    bool m_active;
+    Message m_in;
+    Message m_out;
+};
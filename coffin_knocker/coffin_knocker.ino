@@ -34,138 +34,15 @@
 //   is very large and hard to control, so I'll probably complete it with a
 //   basic PIR motion sensor.
 
-#include <EEPROM.h>
+#include "../basicparser.h"
+#include "../commandbuffer.h"
+#include "../eventlog.h"
+#include "../parameters.h"
+#include "../timerwheel.h"
 
 int constexpr motion_pin  = 2;  // input, HIGH indicates motion
 int constexpr solenoid_pin = 9;  // output, HIGH opens the valve
 
-template <uint8_t BUFFER_SIZE>
-class CommandBuffer {
-  public:
-    void begin() {
-      memset(buf, '\0', BUFFER_SIZE);
-      buflen = 0;
-    }
-
-    bool available() {
-      while (Serial.available()) {
-        char ch = Serial.read();
-        if (buflen == BUFFER_SIZE) buflen = 0;
-        switch (ch) {
-          case '\r': break;
-          case '\n':
-            buf[buflen] = '\0';
-            buflen = 0;
-            return true;
-          case ' ': case '\t':
-            if (buflen == 0) break;
-            if (buf[buflen - 1] == ' ') break;
-            buf[buflen++] = ' ';
-            break;
-          default:
-            if (ch < ' ') break;
-            if ('a' <= ch && ch <= 'z') ch = ch - 'a' + 'A';
-            buf[buflen++] = ch;
-            break;
-        }
-      }
-      return false;
-    }
-
-    operator const char *() const { return buf; }
-
-  private:
-    char buf[BUFFER_SIZE];
-    uint8_t buflen = 0;
-};
-
-template <uint8_t COUNT, int MAGIC, int VERSION>
-class Parameters {
-  public:
-    bool load_defaults() {
-      memset(m_values, 0, sizeof(m_values));
-      if (!do_load_defaults()) {
-        return false;
-      }
-      m_version = VERSION;
-      return true;
-    }
-
-    bool sane() const {
-      return (m_version == VERSION) && do_sane();
-    }
-
-    bool load_from_eeprom(int base_address = 0) {
-      auto addr = base_address;
-      int signature = 0;
-      EEPROM.get(addr, signature); addr += sizeof(signature);
-      if (signature != MAGIC) return false;  // never been saved
-
-      EEPROM.get(addr, m_version); addr += sizeof(m_version);
-      if (m_version <= 0) return false;
-
-      auto *p = reinterpret_cast<uint8_t *>(m_values);
-      for (unsigned i = 0; i < sizeof(m_values); ++i) {
-        *p++ = EEPROM.read(addr++);
-      }
-
-      return m_version == VERSION;
-    }
-
-    bool save_to_eeprom(int base_address = 0) const {
-      auto addr = base_address;
-      auto const signature = MAGIC;
-      EEPROM.put(addr, signature); addr += sizeof(signature);
-      EEPROM.put(addr, m_version); addr += sizeof(m_version);
-      auto const *p = reinterpret_cast<uint8_t const *>(m_values);
-      for (unsigned i = 0; i < sizeof(m_values); ++i) {
-        EEPROM.update(addr++, *p++);
-      }
-      return true;
-    }
-
-    void clear_eeprom(int base_address = 0) {
-      // All we have to do is wipe out the magic number.
-      int const signature = !MAGIC;
-      EEPROM.put(base_address, signature);
-    }
-
-    void print_name(uint8_t i) {
-      if (i >= COUNT) return;
-      do_print_name(i);
-    }
-
-    void show() const {
-      for (uint8_t i = 0; i < COUNT; ++i) {
-        Serial.print(F(" "));
-        do_print_name(i);
-        Serial.print(F(" = "));
-        Serial.println(m_values[i]);
-      }
-    }
-
-  protected:
-    long get_by_index(uint8_t i) const {
-      return (0 <= i && i < COUNT) ? m_values[i] : 0L;
-    }
-
-    bool set_by_index(uint8_t i, long value) {
-      if (i < COUNT) {
-        m_values[i] = value;
-        return true;
-      }
-      return false;
-    }
-
-  private:
-    virtual bool do_load_defaults() = 0;
-    virtual bool do_sane() const = 0;
-    virtual void do_print_name(uint8_t i) const = 0;
-
-    int m_version;
-    long m_values[COUNT];
-};
-
 enum class Parameter : uint8_t {
   // VERSION 1
   SUSPENSE_TIME,
@@ -181,7 +58,7 @@ enum class Parameter : uint8_t {
 };
 
 class CoffinKnockerParameters :
-  public Parameters<static_cast<uint8_t>(Parameter::COUNT), 307, 1>
+  public Parameters<static_cast<uint8_t>(Parameter::COUNT), 307, 1, 16>
 {
   public:
     // The suspense time is how long (in milliseconds) after motion is detected
@@ -267,153 +144,195 @@ char const * const CoffinKnockerParameters::m_names[] PROGMEM = {
   NAME_LOCKOUT
 };
 
-enum class State : uint8_t {
-  // The normal operating states...
-  waiting,
-  suspense,
-  knock_on,
-  knock_off,
-  lockout,
-
-  // Meta states...
-  programming
-} state = State::programming;
-
-// timeout is the time the next state change should occur (millis).
-unsigned long timeout = 0;
-// knock_timeout is the time the current knock_on or knock_off ends.
-unsigned long knock_timeout = 0;
-
-CommandBuffer<32> command;
-
-class Parser {
+// The knock pattern for a run is generated all at once when the prop is
+// triggered, while we're waiting out the suspense time anyway.  Then a
+// 1 kHz timer interrupt plays it back, so the solenoid edges don't
+// depend on what the loop is doing (like printing to Serial).
+class KnockSchedule {
   public:
-    explicit Parser(char const * buffer) : m_p(buffer) {}
-
-    long parseLong() {
-      while (Accept(' ')) {}
-      const bool neg = Accept('-');
-      if (!neg) Accept('+');
-      const auto result = static_cast<long>(parseUnsignedLong());
-      return neg ? -result : result;
-    }
+    // Each knock takes two entries, so this allows 32 knocks per run,
+    // which is plenty for the default settings.  If the settings ask for
+    // more, the run ends early.
+    static uint8_t constexpr MAX_EDGES = 64;
 
-    unsigned long parseUnsignedLong() {
-      while (Accept(' ')) {}
-      unsigned long result = 0;
-      while (MatchDigit()) {
-        result *= 10;
-        result += *m_p - '0';
-        Advance();
+    void begin() {
+      m_running = false;
+#if defined(__AVR__)
+      // Timer1 in CTC mode, with a prescaler of 64, interrupting at 1 kHz.
+      TCCR1A = 0;
+      TCCR1B = bit(WGM12) | bit(CS11) | bit(CS10);
+      OCR1A = F_CPU / 64 / 1000 - 1;
+      TIMSK1 &= ~bit(OCIE1A);
+#endif
+    }
+
+    // Fills in alternating on and off times (in milliseconds) until
+    // they add up to a random run time.  Returns the number of knocks.
+    template <typename ParamsType>
+    uint8_t generate(ParamsType const &p) {
+      stop();
+      long remaining = p.random_run_time();
+      m_count = 0;
+      while (remaining > 0 && m_count < MAX_EDGES) {
+        long const on = p.random_knock_on_time();
+        long const off = p.random_knock_off_time();
+        m_deltas[m_count++] = on;
+        m_deltas[m_count++] = off;
+        remaining -= on + off;
       }
-      return result;
+      return m_count / 2;
     }
 
-    bool Advance() { ++m_p; return true; }
+    // Starts the playback with the first knock.
+    void start() {
+      m_next = 0;
+      m_remaining = 0;
+      m_running = m_count > 0;
+#if defined(__AVR__)
+      TCNT1 = 0;
+      TIFR1 = bit(OCF1A);
+      TIMSK1 |= bit(OCIE1A);
+#endif
+    }
 
-    bool Accept(char ch) { return (*m_p == ch) ? Advance() : false; }
-    bool MatchDigit() const { return '0' <= *m_p && *m_p <= '9'; }
-    bool MatchLetter() const {
-        return ('A' <= *m_p && *m_p <= 'Z') ||
-               ('a' <= *m_p && *m_p <= 'z');
+    void stop() {
+#if defined(__AVR__)
+      TIMSK1 &= ~bit(OCIE1A);
+#endif
+      m_running = false;
+      digitalWrite(solenoid_pin, LOW);
     }
 
+    bool running() const { return m_running; }
 
-    bool Expect() { return true; }
+    // Call from the timer ISR.
+    void tick() {
+      if (!m_running) return;
+      if (m_remaining > 1) {
+        --m_remaining;
+        return;
+      }
+      if (m_next == m_count) {
+        stop();
+        return;
+      }
+      // Even entries are knocks, odd entries are the pauses after them.
+      digitalWrite(solenoid_pin, (m_next & 1) ? LOW : HIGH);
+      m_remaining = m_deltas[m_next++];
+    }
 
-    template <typename ... T>
-    bool Expect(char head, T... tail) { return Accept(head) && Expect(tail...); }
+  private:
+    uint16_t m_deltas[MAX_EDGES];
+    uint8_t m_count = 0;
+    // These are shared with the ISR.
+    volatile uint8_t m_next = 0;
+    volatile uint16_t m_remaining = 0;
+    volatile bool m_running = false;
+} knocks;
+
+#if defined(__AVR__)
+ISR(TIMER1_COMPA_vect) { knocks.tick(); }
+#endif
 
-    bool AllowSuffix() { return Accept(' ') || !MatchLetter(); }
+enum class State : uint8_t {
+  // The normal operating states...
+  waiting,
+  suspense,
+  knocking,
+  lockout,
 
-    template <typename ... T>
-    bool AllowSuffix(char head, T... tail) {
-      if (Accept(head)) return AllowSuffix(tail...);
-      return Accept(' ') || !MatchLetter();
-    }
+  // Meta states...
+  programming
+} state = State::programming;
 
-    const char *m_p;
+// State changes go in the event log, which the loop sends to the console
+// as the serial port has room, so they don't hold up the knocking.
+enum : uint8_t { EV_WAITING, EV_TRIGGERED, EV_CANCELED, EV_ANIMATING, EV_LOCKOUT };
+char const MSG_WAITING[]   PROGMEM = "Waiting...";
+char const MSG_TRIGGERED[] PROGMEM = "Triggered, % knocks";
+char const MSG_CANCELED[]  PROGMEM = "Canceled";
+char const MSG_ANIMATING[] PROGMEM = "Animating!";
+char const MSG_LOCKOUT[]   PROGMEM = "Lockout";
+char const * const messages[] PROGMEM = {
+  MSG_WAITING, MSG_TRIGGERED, MSG_CANCELED, MSG_ANIMATING, MSG_LOCKOUT
 };
+EventLog<16> event_log(messages);
+
+// The suspense and lockout states end when state_timer expires.
+TimerWheel timers;
+Timer state_timer;
+
+static void end_suspense(void *) {
+  if (state != State::suspense) return;
+  if (digitalRead(motion_pin) == LOW) {
+    // This won't ever happen if the suspense_time is less than the
+    // minimum time the sensor will signal a motion event.
+    state = State::waiting;
+    event_log.record(EV_CANCELED);
+  } else {
+    knocks.start();
+    state = State::knocking;
+    event_log.record(EV_ANIMATING);
+  }
+}
+
+static void end_lockout(void *) {
+  if (state != State::lockout) return;
+  state = State::waiting;
+  event_log.record(EV_WAITING);
+}
+
+CommandBuffer<32, 32, UppercaseCommandPolicy> command;
 
 enum class Keyword : uint8_t {
-  UNKNOWN, CLEAR, DEFAULTS, EEPROM, HELP, LIST, LOAD, RUN, SAVE, SET
+  UNKNOWN, CLEAR, DEFAULTS, EEPROM, HELP, LIST, LOAD, LOG, RUN, SAVE, SET
 };
 
-class CoffinKnockerParser : public Parser {
+class CoffinKnockerParser : public BasicParser {
   public:
-    CoffinKnockerParser(char const *buffer) : Parser(buffer) {}
+    CoffinKnockerParser(char const *buffer) : BasicParser(buffer) {}
 
+    // CommandBuffer has already converted the command to uppercase, so
+    // the match can be case-sensitive.
     Keyword parseKeyword() {
-      if (Accept('C')) return AllowSuffix(Keyword::CLEAR, 'L', 'E', 'A', 'R');
-      if (Accept('D')) return AllowSuffix(Keyword::DEFAULTS, 'E', 'F', 'A', 'U', 'L', 'T', 'S');
-      if (Accept('E')) {
-        Accept('E');  // Allow "EEPROM" or "EPROM"
-        return AllowSuffix(Keyword::EEPROM, 'P', 'R', 'O', 'M');
-      }
-      if (Accept('H')) return AllowSuffix(Keyword::HELP, 'E', 'L', 'P');
-      if (Accept('L')) {
-        if (Accept('I')) return AllowSuffix(Keyword::LIST, 'S', 'T');
-        if (Accept('O')) return AllowSuffix(Keyword::LOAD, 'A', 'D');
-        return Keyword::UNKNOWN;
-      }
-      if (Accept('R')) return AllowSuffix(Keyword::RUN, 'U', 'N');
-      if (Accept('S')) {
-        if (Accept('A')) return AllowSuffix(Keyword::SAVE, 'V', 'E');
-        if (Accept('E')) return AllowSuffix(Keyword::SET, 'T');
-        return Keyword::UNKNOWN;
-      }
-      return Keyword::UNKNOWN;
+      return parseKeywordFrom(s_keywords, Keyword::UNKNOWN);
     }
 
     Parameter parseParameter() {
-      if (Accept('L')) return AllowSuffix(Parameter::LOCKOUT_TIME, 'O', 'C', 'K', 'O', 'U', 'T');
-      if (Accept('M')) {
-        if (Accept('A')) {
-          if (Expect('X', '_')) {
-            if (Accept('K')) {
-              if (Expect('N', 'O', 'C', 'K', '_', 'O')) {
-                if (Accept('F')) return AllowSuffix(Parameter::MAX_KNOCK_OFF_TIME, 'F');
-                if (Accept('N')) return AllowSuffix(Parameter::MAX_KNOCK_ON_TIME);
-                return Parameter::COUNT;
-              }
-              return Parameter::COUNT;
-            }
-            if (Accept('R')) return AllowSuffix(Parameter::MAX_RUN_TIME, 'U', 'N');
-            return Parameter::COUNT;
-          }
-          return Parameter::COUNT;
-        }
-        if (Accept('I')) {
-          if (Expect('N', '_')) {
-            if (Accept('K')) {
-              if (Expect('N', 'O', 'C', 'K', '_', 'O')) {
-                if (Accept('F')) return AllowSuffix(Parameter::MIN_KNOCK_OFF_TIME, 'F');
-                if (Accept('N')) return AllowSuffix(Parameter::MIN_KNOCK_ON_TIME);
-                return Parameter::COUNT;
-              }
-              return Parameter::COUNT;
-            }
-            if (Accept('R')) return AllowSuffix(Parameter::MIN_RUN_TIME, 'U', 'N');
-            return Parameter::COUNT;
-          }
-          return Parameter::COUNT;
-        }
-        return Parameter::COUNT;
-      }
-      if (Accept('S')) return AllowSuffix(Parameter::SUSPENSE_TIME, 'U', 'S', 'P', 'E', 'N', 'S', 'E');
-      return Parameter::COUNT;
+      return parseKeywordFrom(s_parameters, Parameter::COUNT);
     }
 
   private:
-    template <typename ... T>
-    Keyword AllowSuffix(Keyword kw, T... suffix) {
-      return Parser::AllowSuffix(suffix...) ? kw : Keyword::UNKNOWN;
-    }
+    static constexpr uint8_t KEYWORD_COUNT = 11;
+    static constexpr uint8_t PARAMETER_COUNT = static_cast<uint8_t>(Parameter::COUNT);
+    static const KeywordEntry<Keyword, 9> s_keywords[KEYWORD_COUNT];
+    static const KeywordEntry<Parameter, 14> s_parameters[PARAMETER_COUNT];
+};
 
-    template <typename ... T>
-    Parameter AllowSuffix(Parameter p, T... suffix) {
-      return Parser::AllowSuffix(suffix...) ? p : Parameter::COUNT;
-    }
+// Sorted by spelling.
+KeywordEntry<Keyword, 9> const CoffinKnockerParser::s_keywords[] PROGMEM = {
+  {Keyword::CLEAR,    "CLEAR"},
+  {Keyword::DEFAULTS, "DEFAULTS"},
+  {Keyword::EEPROM,   "EEPROM"},
+  {Keyword::EEPROM,   "EPROM"},
+  {Keyword::HELP,     "HELP"},
+  {Keyword::LIST,     "LIST"},
+  {Keyword::LOAD,     "LOAD"},
+  {Keyword::LOG,      "LOG"},
+  {Keyword::RUN,      "RUN"},
+  {Keyword::SAVE,     "SAVE"},
+  {Keyword::SET,      "SET"}
+};
+
+KeywordEntry<Parameter, 14> const CoffinKnockerParser::s_parameters[] PROGMEM = {
+  {Parameter::LOCKOUT_TIME,       "LOCKOUT"},
+  {Parameter::MAX_KNOCK_OFF_TIME, "MAX_KNOCK_OFF"},
+  {Parameter::MAX_KNOCK_ON_TIME,  "MAX_KNOCK_ON"},
+  {Parameter::MAX_RUN_TIME,       "MAX_RUN"},
+  {Parameter::MIN_KNOCK_OFF_TIME, "MIN_KNOCK_OFF"},
+  {Parameter::MIN_KNOCK_ON_TIME,  "MIN_KNOCK_ON"},
+  {Parameter::MIN_RUN_TIME,       "MIN_RUN"},
+  {Parameter::SUSPENSE_TIME,      "SUSPENSE"}
 };
 
 static void help() {
@@ -426,6 +345,7 @@ static void help() {
   Serial.println(F(" LIST          - shows current settings"));
   Serial.println(F(" LOAD DEFAULTS - sets current settings to factory defaults"));
   Serial.println(F(" LOAD EEPROM   - loads previously saved settings"));
+  Serial.println(F(" LOG?          - shows the latest events"));
   Serial.println(F(" RUN           - runs the prop with the current settings"));
   Serial.println(F(" SAVE EEPROM   - saves current settings to EEPROM"));
   Serial.println(F(" SET <setting>=<value>"));
@@ -469,7 +389,7 @@ static bool load_from_eeprom() {
   return true;
 }
 
-static bool run(unsigned long now) {
+static bool run() {
   if (!params.sane()) {
     Serial.println(F("Cannot run with current settings."));
     state = State::programming;
@@ -477,8 +397,7 @@ static bool run(unsigned long now) {
   }
 
   state = State::waiting;
-  Serial.print(now);
-  Serial.println(F(" Waiting..."));
+  event_log.record(EV_WAITING);
   return true;
 }
 
@@ -490,16 +409,16 @@ static bool save_to_eeprom() {
   return true;  
 }
 
-static bool trigger(unsigned long now) {
+static bool trigger() {
   if (!params.sane()) {
     Serial.println(F("Cannot run with current settings."));
     state = State::programming;
     return false;
   }
-  timeout = now + params.suspense_time();
+  timers.start(state_timer, params.suspense_time(), end_suspense);
   state = State::suspense;
-  Serial.print(now);
-  Serial.println(F(" Triggered"));
+  uint8_t const count = knocks.generate(params);
+  event_log.record(EV_TRIGGERED, count);
   return true;
 }
 
@@ -512,6 +431,10 @@ static void execute_command(char const *command) {
       clear();
       return;
     case Keyword::LIST:  list();  return;
+    case Keyword::LOG:
+      parser.Accept('?');
+      event_log.dump();
+      return;
     case Keyword::LOAD:
       switch (parser.parseKeyword()) {
         case Keyword::DEFAULTS:
@@ -523,7 +446,7 @@ static void execute_command(char const *command) {
       }
       break;
     case Keyword::RUN:
-      if (!run(millis())) break;
+      if (!run()) break;
       return;
     case Keyword::SAVE:
       if (parser.parseKeyword() != Keyword::EEPROM) break;
@@ -532,7 +455,8 @@ static void execute_command(char const *command) {
     case Keyword::SET: {
       Parameter const p = parser.parseParameter();
       if (p == Parameter::COUNT) break;
-      parser.Accept(':'); parser.Accept('='); parser.Accept(' ');
+      parser.SkipWhitespace();
+      parser.Accept(':'); parser.Accept('='); parser.SkipWhitespace();
       if (!parser.MatchDigit()) break;
       long value = parser.parseLong();
       if (!params.set(p, value)) break;
@@ -554,13 +478,17 @@ void setup() {
   Serial.println(F("\nCoffin Knocker"));
 
   EEPROM.begin();
+  command.begin();
+  // Puts Timer1 in 1 kHz CTC mode for the knock schedule, before anything
+  // can trigger.
+  knocks.begin();
 
   int const seed = analogRead(A0);
   Serial.print(F("Random Seed: "));
   Serial.println(seed);
   randomSeed(seed);
 
-  if (!((load_from_eeprom() || load_defaults()) && run(millis()))) {
+  if (!((load_from_eeprom() || load_defaults()) && run())) {
     help();
   }
 }
@@ -574,6 +502,7 @@ void loop() {
   if (command.available()) {
     if (state != State::programming) {
       state = State::programming;
+      timers.cancel(state_timer);
       Serial.print(F("> "));
     }
     Serial.println(command);
@@ -584,79 +513,38 @@ void loop() {
     }
   }
 
-  // We set the solenoid output every time through the loop, not just when
-  // it changes.  This ensures we de-energize the solenoid valve if there's
+  // While the knock schedule is running, its timer interrupt drives the
+  // solenoid.  In every other state, we make sure it's stopped and the
+  // solenoid is off every time through the loop, not just when the state
+  // changes.  This ensures we de-energize the solenoid valve if there's
   // ever an unexpected state change.
-  digitalWrite(solenoid_pin, state == State::knock_on ? HIGH : LOW);
+  if (state != State::knocking) knocks.stop();
 
-  unsigned long const now = millis();
+  // The suspense and lockout states end from here.
+  timers.update();
 
   switch (state) {
     case State::waiting: {
-      if (motion == HIGH) trigger(now);
+      if (motion == HIGH) trigger();
       break;
     }
 
     case State::suspense: {
-      if (now >= timeout) {
-        if (motion == LOW) {
-          // This won't ever happen if the suspense_time is less than the
-          // minimum time the sensor will signal a motion event.
-          state = State::waiting;
-          Serial.print(now);
-          Serial.println(F(" Canceled"));
-        } else {
-          long const run_time = params.random_run_time();
-          timeout = now + run_time;
-          knock_timeout = now;
-          state = State::knock_off;
-          Serial.print(now);
-          Serial.println(F(" Animating!"));
-        }
-      }
-      break;
-    }
-
-    case State::knock_on: {
-      if (now >= timeout) {
-        timeout = now + params.lockout_time();
-        state = State::lockout;
-        Serial.print(now);
-        Serial.println(F(" Lockout"));
-        break;
-      }
-      if (now >= knock_timeout) {
-        long const knock_off_time = params.random_knock_off_time();
-        knock_timeout = now + knock_off_time;
-        state = State::knock_off;
-      }
+      // state_timer ends this one.
       break;
     }
 
-    case State::knock_off: {
-      if (now >= timeout) {
-        timeout = now + params.lockout_time();
+    case State::knocking: {
+      if (!knocks.running()) {
+        timers.start(state_timer, params.lockout_time(), end_lockout);
         state = State::lockout;
-        Serial.print(now);
-        Serial.println(F(" Lockout"));
-        break;
-      }
-      if (now >= knock_timeout) {
-        long const knock_time = params.random_knock_on_time();
-        knock_timeout = now + knock_time;
-        state = State::knock_on;
-        Serial.print(now);
-        Serial.println(F(" Bang!"));
+        event_log.record(EV_LOCKOUT);
       }
       break;
     }
 
     case State::lockout: {
-      if (now >= timeout) {
-        state = State::waiting;
-        Serial.print(now);
-        Serial.println(F(" Waiting..."));
-      }
+      // And this one.
       break;
     }
 
@@ -664,4 +552,7 @@ void loop() {
       break;
     }
   }
+
+  // Send whatever the serial port has room for.
+  while (event_log.update()) {}
 }
@@ -1,32 +1,160 @@
-template <int BUFFER_SIZE>
+// Buffered command lines from Serial
+
+// Each call to `available` moves whatever has arrived from Serial's
+// receive buffer into a ring buffer, so Serial's own (small) buffer
+// doesn't overflow while a burst of commands is being handled.  The ring
+// can hold several complete lines, which are handed out one at a time.
+//
+// A line that's too long to fit in the line buffer is dropped in its
+// entirety rather than wrapped, so the parser never sees a corrupted
+// command.  Dropped lines are counted by `overflows`.
+//
+// By default, each line is echoed back with a "> " prefix.  The echo is
+// written only if it fits in Serial's transmit buffer, so it never stalls
+// the loop.  When something is streaming commands at full speed, some
+// echoes may be skipped; use `enableEcho(false)` to turn them off.
+//
+// The Policy decides how characters are normalized as they arrive and
+// whether echo is available at all.  Because the choices are made at
+// compile time, a prop pays only for the processing it uses.
+
+#pragma once
+
+// Passes the text through as is (except for carriage returns, which are
+// always dropped).
+struct RawCommandPolicy {
+  static constexpr bool collapse_whitespace = false;
+  static constexpr bool echo = true;
+  // Returns the character to store, or '\0' to drop it.
+  static char normalize(char ch) { return ch; }
+};
+
+// Drops control characters, collapses runs of spaces and tabs into a
+// single space, skips leading whitespace, and converts letters to
+// uppercase.  This lets a parser use case-sensitive keyword matching and
+// expect at most one space between words.  The sketch handles echo.
+struct UppercaseCommandPolicy {
+  static constexpr bool collapse_whitespace = true;
+  static constexpr bool echo = false;
+  static char normalize(char ch) {
+    if (ch == '\t') return ' ';
+    if (ch < ' ') return '\0';
+    if ('a' <= ch && ch <= 'z') return ch - 'a' + 'A';
+    return ch;
+  }
+};
+
+template <int LINE_SIZE, int QUEUE_SIZE = 2*LINE_SIZE, typename Policy = RawCommandPolicy>
 class CommandBuffer {
   public:
+    static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "QUEUE_SIZE must be a power of 2");
+    static_assert(LINE_SIZE <= QUEUE_SIZE, "QUEUE_SIZE must hold at least one line");
+    static_assert(QUEUE_SIZE <= 128, "QUEUE_SIZE is too big for byte-sized counts");
+
     void begin() {
-      memset(buf, '\0', sizeof(buf));
-      buflen = 0;
+      m_line[0] = '\0';
+      m_head = 0;
+      m_count = 0;
+      m_lines = 0;
+      m_partial = 0;
+      m_discarding = false;
+      m_overflows = 0;
     }
 
+    void enableEcho(bool enable) { m_echo = enable; }
+
+    // Returns true if a complete line is ready.  The line remains valid
+    // until the next call.
     bool available() {
-      while (Serial.available()) {
-        char ch = Serial.read();
-        if (buflen == sizeof(buf)) buflen = 0;
-        if (ch != '\n') {
-          buf[buflen++] = ch;
-          continue;
-        }
+      receive();
+      if (m_lines == 0) return false;
+      uint8_t len = 0;
+      for (char ch = pop(); ch != '\n'; ch = pop()) m_line[len++] = ch;
+      m_line[len] = '\0';
+      --m_lines;
+      if (Policy::echo && m_echo) echo(len);
+      return true;
+    }
+
+    // True if more complete lines are already queued.
+    bool pending() const { return m_lines != 0; }
 
-        buf[buflen] = '\0';
-        buflen = 0;
-        Serial.print(F("> "));
-        Serial.println(buf);
-        return true;
+    // The number of lines dropped for being too long.
+    unsigned overflows() const { return m_overflows; }
+
+    operator const char *() const { return m_line; }
+
+  private:
+    static constexpr uint8_t QUEUE_MASK = QUEUE_SIZE - 1;
+
+    void receive() {
+      // If the ring fills, we leave the rest in Serial's buffer until
+      // some lines have been consumed.
+      while (m_count < QUEUE_SIZE && Serial.available()) {
+        const char ch = Serial.read();
+        switch (ch) {
+          case '\r': break;
+          case '\n':
+            if (m_discarding) {
+              m_discarding = false;
+              ++m_overflows;
+              break;
+            }
+            push(ch);
+            ++m_lines;
+            m_partial = 0;
+            break;
+          default: {
+            if (m_discarding) break;
+            const char c = Policy::normalize(ch);
+            if (c == '\0') break;
+            if (Policy::collapse_whitespace && c == ' ') {
+              if (m_partial == 0 || m_last == ' ') break;
+            }
+            if (m_partial == LINE_SIZE - 1) {
+              // Take back the part we've already queued and ignore the
+              // rest of the line.
+              m_count -= m_partial;
+              m_partial = 0;
+              m_discarding = true;
+              break;
+            }
+            push(c);
+            ++m_partial;
+            m_last = c;
+            break;
+          }
+        }
       }
-      return false;
     }
 
-    operator const char *() const { return buf; }
+    void push(char ch) {
+      m_queue[(m_head + m_count) & QUEUE_MASK] = ch;
+      ++m_count;
+    }
 
-  private:
-    char buf[BUFFER_SIZE];
-    int buflen = 0;
+    char pop() {
+      const char ch = m_queue[m_head];
+      m_head = (m_head + 1) & QUEUE_MASK;
+      --m_count;
+      return ch;
+    }
+
+    void echo(uint8_t len) {
+      // "> ", the line, and CR LF.
+      if (Serial.availableForWrite() < len + 4) return;
+      Serial.print(F("> "));
+      Serial.println(m_line);
+    }
+
+    char m_queue[QUEUE_SIZE];
+    char m_line[LINE_SIZE];
+    uint8_t m_head = 0;
+    uint8_t m_count = 0;    // bytes in the queue
+    uint8_t m_lines = 0;    // complete lines in the queue
+    uint8_t m_partial = 0;  // length of the incomplete line at the end
+    bool m_discarding = false;
+    bool m_echo = Policy::echo;
+    char m_last = '\0';  // the last character queued
+    unsigned m_overflows = 0;
 };
@@ -0,0 +1,186 @@
+// An event log in RAM, flushed to the console when there's room
+
+// At 115200 baud, a line of text takes about a millisecond to send, and
+// once the serial port's transmit buffer is full, every print waits for
+// it.  An EventLog instead stores each event as a small fixed-size record
+// in a ring: the time, an event ID, and two numbers.  Recording one is a
+// few dozen cycles, and it's safe from an interrupt handler.
+//
+// The text lives in program memory, in a table indexed by event ID.
+// Each '%' in a message is replaced by the next argument:
+//
+//     enum : uint8_t { EV_TRIGGERED, EV_LOCKOUT };
+//     const char msg_triggered[] PROGMEM = "Triggered, % knocks";
+//     const char msg_lockout[]   PROGMEM = "Lockout";
+//     const char *const messages[] PROGMEM = { msg_triggered, msg_lockout };
+//     EventLog<16> event_log(messages);
+//     ...
+//     event_log.record(EV_TRIGGERED, count);
+//
+// `update`, from a low-priority task, formats the oldest record that
+// hasn't been sent and writes the line only if the port has room for all
+// of it, so it never waits.  Lines come out as "<millis> <message>".
+//
+// The ring keeps the latest SIZE records.  If they arrive faster than
+// they can be sent, the oldest are overwritten, and `lost` counts them.
+// `dump` prints everything still in the ring, sent or not, which is handy
+// for a "log?" command after the fact.
+
+#pragma once
+
+struct LogRecord {
+  unsigned long time;
+  uint8_t id;
+  uint16_t a;
+  uint16_t b;
+};
+
+template <uint8_t SIZE = 16>
+class EventLog {
+  public:
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+    static_assert(SIZE <= 128, "SIZE is too big for byte-sized counts");
+
+    // `messages` is a PROGMEM table of PROGMEM strings.  `out` must be a
+    // port that reports its room, like HardwareSerial.
+    template <size_t N>
+    explicit EventLog(const char *const (&messages)[N], Print &out = Serial) :
+      m_messages(messages), m_message_count(N), m_out(out) {}
+
+    void record(uint8_t id, uint16_t a = 0, uint16_t b = 0) {
+      recordAt(millis(), id, a, b);
+    }
+
+    // For an event that happened at `time` (millis) rather than now.
+    void recordAt(unsigned long time, uint8_t id, uint16_t a = 0, uint16_t b = 0) {
+#if defined(__AVR__)
+      const uint8_t sreg = SREG;
+      cli();
+#endif
+      auto &r = m_ring[m_head];
+      r.time = time;
+      r.id = id;
+      r.a = a;
+      r.b = b;
+      m_head = (m_head + 1) & MASK;
+      if (m_count < SIZE) ++m_count;
+      if (m_unsent < SIZE) ++m_unsent; else ++m_lost;
+#if defined(__AVR__)
+      SREG = sreg;
+#endif
+    }
+
+    // Sends the next line if the port has room for it.  Returns true if
+    // it sent one, so a scheduler task can keep going while there's room.
+    bool update() {
+      if (m_line.length == 0) {
+        LogRecord r;
+        if (!pop(r)) return false;
+        format(r, m_line);
+      }
+      if (m_out.availableForWrite() < m_line.length) return false;
+      m_out.write(m_line.text, m_line.length);
+      m_line.length = 0;
+      return true;
+    }
+
+    // Prints every record in the ring, oldest first, waiting as needed.
+    void dump() {
+      const uint8_t count = m_count;
+      for (uint8_t i = count; i > 0; --i) {
+        LogRecord r;
+        if (!peek(i, r)) continue;
+        format(r, m_out);
+      }
+      if (m_lost != 0) {
+        m_out.print(m_lost);
+        m_out.println(F(" events lost"));
+      }
+    }
+
+    // The number of records overwritten before they were sent.
+    unsigned lost() const { return m_lost; }
+
+  private:
+    static constexpr uint8_t MASK = SIZE - 1;
+
+    // Holds a formatted line until the port has room.  Text past the end
+    // of the buffer is cut off, but there's always room for the newline.
+    struct Line : public Print {
+      static constexpr uint8_t CAPACITY = 42;
+      char text[CAPACITY];
+      uint8_t length = 0;
+
+      size_t write(uint8_t ch) override {
+        const bool newline = ch == '\r' || ch == '\n';
+        if (length == (newline ? CAPACITY : CAPACITY - 2)) return 0;
+        text[length++] = ch;
+        return 1;
+      }
+      using Print::write;
+    };
+
+    bool pop(LogRecord &r) {
+#if defined(__AVR__)
+      const uint8_t sreg = SREG;
+      cli();
+#endif
+      const bool found = m_unsent != 0;
+      if (found) {
+        r = m_ring[(m_head - m_unsent) & MASK];
+        --m_unsent;
+      }
+#if defined(__AVR__)
+      SREG = sreg;
+#endif
+      return found;
+    }
+
+    // Copies the record `age` back from the newest, where 1 is the newest.
+    bool peek(uint8_t age, LogRecord &r) const {
+#if defined(__AVR__)
+      const uint8_t sreg = SREG;
+      cli();
+#endif
+      const bool found = age <= m_count;
+      if (found) r = m_ring[(m_head - age) & MASK];
+#if defined(__AVR__)
+      SREG = sreg;
+#endif
+      return found;
+    }
+
+    void format(const LogRecord &r, Print &out) const {
+      out.print(r.time);
+      out.print(' ');
+      if (r.id >= m_message_count) {
+        out.print(F("event "));
+        out.print(r.id);
+        out.print(' ');
+        out.print(r.a);
+        out.print(' ');
+        out.println(r.b);
+        return;
+      }
+      auto p = reinterpret_cast<const char *>(pgm_read_ptr(&m_messages[r.id]));
+      uint8_t arg = 0;
+      for (char ch = pgm_read_byte(p); ch != '\0'; ch = pgm_read_byte(++p)) {
+        if (ch == '%' && arg < 2) {
+          out.print(arg++ == 0 ? r.a : r.b);
+        } else {
+          out.print(ch);
+        }
+      }
+      out.println();
+    }
+
+    const char *const *m_messages;
+    uint8_t m_message_count;
+    Print &m_out;
+    LogRecord m_ring[SIZE];
+    uint8_t m_head = 0;
+    uint8_t m_count = 0;   // records in the ring
+    uint8_t m_unsent = 0;  // the newest of those that haven't been sent
+    unsigned m_lost = 0;
+    Line m_line;
+};
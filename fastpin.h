@@ -0,0 +1,118 @@
+// Digital pins, with a compile-time fast path
+
+// `digitalWrite` and `digitalRead` look up the port and bit for the pin
+// number in a table, check whether the pin has PWM to turn off, and
+// disable interrupts around the update.  That's dozens of cycles, which
+// matters for things like the MSGEQ7 strobe and the rotary encoder.
+//
+// `FastPin<N>` resolves the port registers and bit mask for pin N at
+// compile time, so `high()`, `low()`, and `read()` compile down to single
+// `sbi`, `cbi`, and `sbic` instructions.  `DigitalPin` has the same
+// interface for a pin number chosen at run time.  Device classes that are
+// templated on their pin types accept either.
+//
+// FastPin doesn't turn off PWM on the pin.  If you've used `analogWrite`
+// on it, use DigitalPin instead.
+
+#pragma once
+
+class DigitalPin {
+  public:
+    // Not explicit, so a plain pin number works wherever a DigitalPin is
+    // expected.
+    DigitalPin(int pin) : m_pin(pin) {}
+
+    void output() const { pinMode(m_pin, OUTPUT); }
+    void input() const { pinMode(m_pin, INPUT); }
+    void inputPullup() const { pinMode(m_pin, INPUT_PULLUP); }
+
+    void high() const { digitalWrite(m_pin, HIGH); }
+    void low() const { digitalWrite(m_pin, LOW); }
+    void write(bool level) const { digitalWrite(m_pin, level ? HIGH : LOW); }
+    bool read() const { return digitalRead(m_pin) == HIGH; }
+
+    int number() const { return m_pin; }
+
+  private:
+    int m_pin;
+};
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+// On the ATmega328P (e.g., Uno, Nano, Pro Mini), digital pins 0-7 are
+// PORTD, 8-13 are PORTB, and 14-19 (A0-A5) are PORTC.
+namespace fastpin {
+  enum Port : char { NONE = 0, B = 'B', C = 'C', D = 'D' };
+
+  constexpr Port portOf(int pin) {
+    return pin < 0 ? NONE : pin < 8 ? D : pin < 14 ? B : pin < 20 ? C : NONE;
+  }
+
+  constexpr uint8_t maskOf(int pin) {
+    return static_cast<uint8_t>(1u << (pin < 8 ? pin : pin < 14 ? pin - 8 : pin - 14));
+  }
+
+  template <Port P> struct Registers;
+  template <> struct Registers<B> {
+    static volatile uint8_t &ddr() { return DDRB; }
+    static volatile uint8_t &out() { return PORTB; }
+    static volatile uint8_t &in()  { return PINB; }
+  };
+  template <> struct Registers<C> {
+    static volatile uint8_t &ddr() { return DDRC; }
+    static volatile uint8_t &out() { return PORTC; }
+    static volatile uint8_t &in()  { return PINC; }
+  };
+  template <> struct Registers<D> {
+    static volatile uint8_t &ddr() { return DDRD; }
+    static volatile uint8_t &out() { return PORTD; }
+    static volatile uint8_t &in()  { return PIND; }
+  };
+}
+
+template <int PIN>
+class FastPin {
+  public:
+    static_assert(fastpin::portOf(PIN) != fastpin::NONE, "no such pin");
+
+    // Single-bit updates of these registers compile to `sbi` and `cbi`,
+    // which are atomic, so we don't need to disable interrupts.
+    static void output() { Regs::ddr() |= MASK; }
+    static void input() { Regs::ddr() &= ~MASK; Regs::out() &= ~MASK; }
+    static void inputPullup() { Regs::ddr() &= ~MASK; Regs::out() |= MASK; }
+
+    static void high() { Regs::out() |= MASK; }
+    static void low() { Regs::out() &= ~MASK; }
+    static void write(bool level) { if (level) high(); else low(); }
+    // Writing a 1 to the input register toggles the output.
+    static void toggle() { Regs::in() = MASK; }
+    static bool read() { return (Regs::in() & MASK) != 0; }
+
+    static constexpr int number() { return PIN; }
+
+  private:
+    typedef fastpin::Registers<fastpin::portOf(PIN)> Regs;
+    static constexpr uint8_t MASK = fastpin::maskOf(PIN);
+};
+
+#else
+
+// We don't have tables for this board, so FastPin falls back to the
+// regular Arduino functions.  It's no faster, but it still works.
+template <int PIN>
+class FastPin {
+  public:
+    static void output() { pinMode(PIN, OUTPUT); }
+    static void input() { pinMode(PIN, INPUT); }
+    static void inputPullup() { pinMode(PIN, INPUT_PULLUP); }
+
+    static void high() { digitalWrite(PIN, HIGH); }
+    static void low() { digitalWrite(PIN, LOW); }
+    static void write(bool level) { digitalWrite(PIN, level ? HIGH : LOW); }
+    static void toggle() { write(!read()); }
+    static bool read() { return digitalRead(PIN) == HIGH; }
+
+    static constexpr int number() { return PIN; }
+};
+
+#endif
@@ -1,44 +1,48 @@
 // Class to control a fog machine via a relay.
 // Adrian McCarthy 2023
 
-class Fogger {
+#pragma once
+
+#include "timerwheel.h"
+
+// Anything that makes fog on request, so the parser and the show timeline
+// can drive a single Fogger or a FoggerBank (see foggerbank.h) alike.
+class FogMachine {
+  public:
+    virtual void on(unsigned long duration = 1000) = 0;
+};
+
+class Fogger : public FogMachine {
   public:
-    Fogger(int pin, int trigger_level = HIGH) :
-      m_pin(pin), m_level(trigger_level), m_timeout(0) {}
+    Fogger(TimerWheel &timers, int pin, int trigger_level = HIGH) :
+      m_timers(timers), m_pin(pin), m_level(trigger_level) {}
 
     void begin() {
       pinMode(m_pin, OUTPUT);
       off();
     }
 
-    void update() {
-      if (m_timeout == 0) return;
-      auto const now = millis();
-      if (m_timeout <= now) {
-        if (now - m_timeout <= MAX_BURST) off();  // legit expiration
-      } else {
-        if (m_timeout - now > MAX_BURST) off();  // clock wrapped
-      }
-    }
-
-    void on(unsigned long duration = 1000) {
-      if (m_timeout == 0) {
-        digitalWrite(m_pin, m_level);
-        duration = (duration > MAX_BURST) ? MAX_BURST : duration;
-        m_timeout = millis() + duration;
-        if (m_timeout == 0) m_timeout = 1;  // because 0 means "off"
-      }
+    void on(unsigned long duration = 1000) override {
+      if (m_burst.running()) return;
+      digitalWrite(m_pin, m_level);
+      duration = (duration > MAX_BURST) ? MAX_BURST : duration;
+      m_timers.start(m_burst, duration, expire, this);
     }
 
     void off() {
+      m_timers.cancel(m_burst);
       digitalWrite(m_pin, m_level == LOW ? HIGH : LOW);
-      m_timeout = 0;
     }
 
+    bool isOn() const { return m_burst.running(); }
+
   private:
+    static void expire(void *context) { static_cast<Fogger *>(context)->off(); }
+
+    TimerWheel &m_timers;
     int const m_pin;
     int const m_level;
-    unsigned long m_timeout;
+    Timer m_burst;
 
     static unsigned long constexpr MAX_BURST = 60000;
-};
\ No newline at end of file
+};
@@ -0,0 +1,268 @@
+// A bank of fog machines that share the fog requests
+
+// A Fogger ignores a request while it's already making fog, and it will
+// happily run its heater flat out.  A FoggerBank queues requests instead,
+// and hands each one to the first of its units that can produce the whole
+// burst, so fog asked for by the show timeline or a motion trigger comes
+// out as soon as possible rather than not at all.
+//
+// A unit can't start a burst until it has rested for its recovery
+// interval.  It also has a duty-cycle budget, because a fogger's heater
+// needs time to get back up to temperature after a long burst: the budget
+// starts full at a minute of fog, each burst spends its length, and
+// resting refills it at the duty cycle's rate.  At 25%, a 15-second burst
+// takes a minute to earn back.  A unit with a duty cycle of 100
+// has no budget, just the recovery interval.
+//
+// All the units are handled in one pass.  The bank keeps a single timer
+// on a TimerWheel (see timerwheel.h) for the earliest deadline among them:
+// a burst ending, a unit settling back to full readiness, or a queued
+// request becoming possible.  Until then, it costs nothing.
+//
+//     const FogUnit units[] = {
+//       //  pin, level, recovery_ms, duty %
+//       {     7, HIGH,        5000,     25},
+//       {    A1, HIGH,        5000,     25}
+//     };
+//     TimerWheel timers;
+//     FoggerBank<2> foggers(units, timers);
+//     ...
+//     foggers.on(3000);  // any unit, for three seconds
+//     foggers.request(3000, 0b10);  // only the second unit
+
+#pragma once
+
+#include "fogger.h"
+
+struct FogUnit {
+  uint8_t pin;
+  uint8_t trigger_level;  // HIGH or LOW
+  uint16_t recovery_ms;   // the least time off between bursts
+  uint8_t duty_percent;   // the longest-run share of time on
+};
+
+template <uint8_t UNITS, uint8_t QUEUE_SIZE = 4>
+class FoggerBank : public FogMachine {
+  public:
+    static_assert(0 < UNITS && UNITS <= 8, "a bank has one to eight units");
+
+    static constexpr uint8_t ALL_UNITS = static_cast<uint8_t>((1u << UNITS) - 1);
+    static constexpr uint16_t MAX_BURST = 60000;
+
+    // The units must outlive the FoggerBank.
+    FoggerBank(const FogUnit (&units)[UNITS], TimerWheel &timers) :
+      m_units(units), m_timers(timers) {}
+
+    void begin() {
+      for (uint8_t u = 0; u < UNITS; ++u) {
+        pinMode(m_units[u].pin, OUTPUT);
+        write(u, false);
+        m_state[u].phase = READY;
+        m_state[u].credit = MAX_BURST;
+        const uint8_t duty = m_units[u].duty_percent;
+        m_rate[u] = duty >= 100 ? UNLIMITED : duty == 0 ? 1 : (256u * duty) / 100;
+      }
+      m_count = 0;
+      m_timers.cancel(m_wake);
+    }
+
+    void on(unsigned long duration = 1000) override { request(duration); }
+
+    // Queues a burst of `duration` milliseconds (up to MAX_BURST) for the
+    // first of `units` (one bit per unit) that can make it.  Returns false
+    // if the queue is full, in which case the request is dropped.
+    bool request(unsigned long duration, uint8_t units = ALL_UNITS) {
+      units &= ALL_UNITS;
+      if (duration == 0 || units == 0) return true;
+      if (m_count == QUEUE_SIZE) { ++m_dropped; return false; }
+      auto &r = m_queue[m_count];
+      r.duration = duration > MAX_BURST ? MAX_BURST : duration;
+      r.units = units;
+      ++m_count;
+      reschedule(millis());
+      return true;
+    }
+
+    // Stops every unit and forgets the queued requests.  The unused part
+    // of a burst goes back into the unit's budget.
+    void off() {
+      const auto now = millis();
+      for (uint8_t u = 0; u < UNITS; ++u) {
+        auto &state = m_state[u];
+        if (state.phase != ON) continue;
+        // A burst that's already due has nothing left to refund.
+        if (hasBudget(u) && !reached(now, state.off_at)) {
+          state.credit += state.off_at - now;
+        }
+        finishBurst(u, now);
+      }
+      m_count = 0;
+      reschedule(now);
+    }
+
+    bool isOn(uint8_t unit) const { return m_state[unit].phase == ON; }
+    uint8_t queued() const { return m_count; }
+
+    // The number of requests dropped because the queue was full.
+    unsigned dropped() const { return m_dropped; }
+
+  private:
+    static constexpr uint16_t UNLIMITED = 0xFFFF;
+
+    enum Phase : uint8_t {
+      ON,          // until off_at
+      RECOVERING,  // until ready_at, then refilling the budget until settle_at
+      READY        // rested, with a full budget
+    };
+
+    struct UnitState {
+      Phase phase;
+      uint16_t credit;            // the budget in ms as of credit_time
+      unsigned long credit_time;
+      unsigned long off_at;
+      unsigned long ready_at;
+      unsigned long settle_at;
+    };
+
+    struct Request {
+      uint16_t duration;
+      uint8_t units;
+    };
+
+    // The signed difference keeps these correct across clock rollover.
+    // Deadlines are never more than a few hours out, and a unit stops
+    // comparing them once it's READY.
+    static bool reached(unsigned long now, unsigned long deadline) {
+      return static_cast<long>(now - deadline) >= 0;
+    }
+
+    bool hasBudget(uint8_t u) const { return m_rate[u] != UNLIMITED; }
+
+    void write(uint8_t u, bool on) {
+      const uint8_t level = m_units[u].trigger_level;
+      digitalWrite(m_units[u].pin, on ? level : (level == LOW ? HIGH : LOW));
+    }
+
+    static void wake(void *context) {
+      static_cast<FoggerBank *>(context)->reschedule(millis());
+    }
+
+    // Handles everything that's due and sets the timer for the next
+    // deadline.
+    void reschedule(unsigned long now) {
+      m_pending = false;
+      for (uint8_t u = 0; u < UNITS; ++u) {
+        auto &state = m_state[u];
+        if (state.phase == ON && reached(now, state.off_at)) {
+          finishBurst(u, state.off_at);
+        }
+        if (state.phase == RECOVERING && reached(now, state.settle_at)) {
+          state.phase = READY;
+          state.credit = MAX_BURST;
+        }
+      }
+      serveQueue(now);
+      for (uint8_t u = 0; u < UNITS; ++u) {
+        const auto &state = m_state[u];
+        if (state.phase == ON) wakeAt(state.off_at);
+        if (state.phase == RECOVERING) wakeAt(state.settle_at);
+      }
+      if (!m_pending) {
+        m_timers.cancel(m_wake);
+        return;
+      }
+      const auto delay = m_next - now;
+      m_timers.start(m_wake, static_cast<long>(delay) > 0 ? delay : 0, wake, this);
+    }
+
+    void wakeAt(unsigned long deadline) {
+      if (!m_pending || static_cast<long>(deadline - m_next) < 0) m_next = deadline;
+      m_pending = true;
+    }
+
+    // Starts whichever requests can start now, in order.  For each of the
+    // others, it notes when a unit could take it.
+    void serveQueue(unsigned long now) {
+      uint8_t i = 0;
+      while (i < m_count) {
+        const Request r = m_queue[i];
+        bool served = false;
+        for (uint8_t u = 0; u < UNITS && !served; ++u) {
+          if ((r.units & (1 << u)) == 0 || m_state[u].phase == ON) continue;
+          const auto start = startTime(u, r.duration, now);
+          if (reached(now, start)) {
+            startBurst(u, r.duration, now);
+            served = true;
+          } else {
+            wakeAt(start);
+          }
+        }
+        if (!served) { ++i; continue; }
+        // Close the gap, keeping the rest in order.
+        for (uint8_t j = i; j + 1 < m_count; ++j) {
+          m_queue[j] = m_queue[j + 1];
+        }
+        --m_count;
+      }
+    }
+
+    // The budget unit `u` will have at `time`, which must not be before
+    // it last changed.
+    uint16_t creditAt(uint8_t u, unsigned long time) const {
+      const auto &state = m_state[u];
+      if (state.phase == READY) return MAX_BURST;
+      unsigned long elapsed = time - state.credit_time;
+      if (elapsed > 0xFFFFFFul) elapsed = 0xFFFFFFul;  // so the product fits
+      const unsigned long credit = state.credit + ((elapsed * m_rate[u]) >> 8);
+      return credit > MAX_BURST ? MAX_BURST : credit;
+    }
+
+    // How long it takes unit `u` to earn `amount` ms of budget.
+    unsigned long earningTime(uint8_t u, uint16_t amount) const {
+      return (static_cast<unsigned long>(amount) * 256 + m_rate[u] - 1) / m_rate[u];
+    }
+
+    // The earliest time unit `u` (not ON) can start a burst of `duration`.
+    unsigned long startTime(uint8_t u, uint16_t duration, unsigned long now) const {
+      const auto &state = m_state[u];
+      if (state.phase == READY) return now;
+      unsigned long start = reached(now, state.ready_at) ? now : state.ready_at;
+      if (hasBudget(u)) {
+        const auto credit = creditAt(u, start);
+        if (credit < duration) start += earningTime(u, duration - credit);
+      }
+      return start;
+    }
+
+    void startBurst(uint8_t u, uint16_t duration, unsigned long now) {
+      auto &state = m_state[u];
+      if (hasBudget(u)) state.credit = creditAt(u, now) - duration;
+      state.phase = ON;
+      state.off_at = now + duration;
+      write(u, true);
+    }
+
+    void finishBurst(uint8_t u, unsigned long at) {
+      auto &state = m_state[u];
+      write(u, false);
+      state.phase = RECOVERING;
+      state.credit_time = at;
+      state.ready_at = at + m_units[u].recovery_ms;
+      state.settle_at = state.ready_at;
+      if (hasBudget(u)) {
+        const auto full = at + earningTime(u, MAX_BURST - state.credit);
+        if (static_cast<long>(full - state.settle_at) > 0) state.settle_at = full;
+      }
+    }
+
+    const FogUnit *m_units;
+    TimerWheel &m_timers;
+    Timer m_wake;
+    UnitState m_state[UNITS];
+    uint16_t m_rate[UNITS];  // budget earned per ms resting, in Q8, or UNLIMITED
+    Request m_queue[QUEUE_SIZE];
+    uint8_t m_count = 0;
+    bool m_pending = false;     // while rescheduling, whether m_next is set
+    unsigned long m_next = 0;
+    unsigned m_dropped = 0;
+};
@@ -0,0 +1,137 @@
+// Framed serial messages
+
+// Manages a buffered message with all the protocol details of the framing
+// used by the YX5200 and YX5300 audio chips:
+//
+//     0x7E 0xFF 0x06 <id> <feedback> <param hi> <param lo> <sum hi> <sum lo> 0xEF
+//
+// The checksum is optional on receive.  The same framing works for other
+// links, like the binary command mode, so it's templated on the type of
+// the message ID.
+
+#pragma once
+
+template <typename ID>
+class FramedMessage {
+  public:
+    enum { START = 0x7E, VERSION = 0xFF, LENGTH = 6, END = 0xEF };
+    enum Feedback { NO_FEEDBACK = 0x00, FEEDBACK = 0x01 };
+
+    FramedMessage() :
+      m_buf{START, VERSION, LENGTH, 0, FEEDBACK, 0, 0, 0, 0, END},
+      m_length(0), m_sum(0), m_valid(false) {}
+
+    void set(ID msgid, uint16_t param, Feedback feedback = NO_FEEDBACK) {
+      setExtended(msgid, feedback, param);
+    }
+
+    // Like `set`, but for links that don't use feedback, so that byte
+    // carries eight more bits of payload.
+    void setExtended(ID msgid, uint8_t extra, uint16_t param) {
+      // Note that we're filling in just the bytes that change.  We rely
+      // on the framing bytes set when the buffer was first initialized.
+      m_buf[3] = msgid;
+      m_buf[4] = extra;
+      m_buf[5] = (param >> 8) & 0xFF;
+      m_buf[6] = (param     ) & 0xFF;
+      const uint16_t checksum = ~sum() + 1;
+      m_buf[7] = (checksum >> 8) & 0xFF;
+      m_buf[8] = (checksum     ) & 0xFF;
+      m_length = 10;
+      m_valid = true;
+    }
+
+    const uint8_t *getBuffer() const { return m_buf; }
+    int getLength() const {
+      return m_length == SHORT_COMPLETE ? 8 : m_length;
+    }
+
+    bool isValid() const { return m_valid; }
+
+    ID getMessageID() const { return static_cast<ID>(m_buf[3]); }
+    bool wantsFeedback() const { return m_buf[4] == FEEDBACK; }
+    uint8_t getParamHi() const { return m_buf[5]; }
+    uint8_t getParamLo() const { return m_buf[6]; }
+    uint16_t getParam() const { return combine(m_buf[5], m_buf[6]); }
+    uint8_t getExtra() const { return m_buf[4]; }
+
+    // Returns true if the byte `b` completes a message, after which
+    // `isValid` says whether it passed the checksum.
+    //
+    // The decoder is resumable, so bytes can be fed in as they arrive
+    // across any number of calls.  The checksum is accumulated as the
+    // bytes come in, so validating a completed message is a single
+    // comparison.  After a framing error, we resync on the next START
+    // byte without going back over what we've already seen.
+    bool receive(uint8_t b) {
+      switch (m_length) {
+        default:
+          // `m_length` is out of bounds (e.g., we just completed a
+          // message), so start fresh.
+          m_length = 0;
+          /* FALLTHROUGH */
+        case 0: case 1: case 2:
+          // These bytes must always match the template.
+          if (b == m_buf[m_length]) {
+            m_sum = (m_length == 0) ? 0 : m_sum + b;
+            ++m_length;
+            return false;
+          }
+          return resync(b);
+        case 3: case 4: case 5: case 6:
+          // These are the payload bytes we care about.
+          m_buf[m_length++] = b;
+          m_sum += b;
+          return false;
+        case 7:
+          // If there's no checksum, the message may end here.
+          if (b == END) {
+            m_buf[7] = b;
+            m_length = SHORT_COMPLETE;
+            m_valid = true;
+            return true;
+          }
+          /* FALLTHROUGH */
+        case 8:
+          m_buf[m_length++] = b;
+          return false;
+        case 9:
+          if (b != END) return resync(b);
+          m_length = 10;
+          m_valid = static_cast<uint16_t>(m_sum + combine(m_buf[7], m_buf[8])) == 0;
+          return true;
+      }
+    }
+
+  private:
+    // Marks a completed frame without a checksum.  A length of 8 would
+    // send the next byte to the checksum's second byte instead of
+    // starting fresh.
+    static constexpr uint8_t SHORT_COMPLETE = 11;
+
+    static constexpr uint16_t combine(uint8_t hi, uint8_t lo) {
+      return static_cast<uint16_t>(hi << 8) | lo;
+    }
+
+    // Sums the bytes used to compute the checksum.
+    uint16_t sum() const {
+      uint16_t s = 0;
+      for (int i = 1; i <= LENGTH; ++i) {
+        s += m_buf[i];
+      }
+      return s;
+    }
+
+    // No match; if this could be the start of a new message, we
+    // pick up from there.
+    bool resync(uint8_t b) {
+      m_sum = 0;
+      m_length = (b == START) ? 1 : 0;
+      return false;
+    }
+
+    uint8_t m_buf[10];
+    uint8_t m_length;
+    uint16_t m_sum;  // running sum of the bytes covered by the checksum
+    bool m_valid;
+};
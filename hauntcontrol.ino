@@ -4,30 +4,158 @@
 // Using Arduino Pro Mini for now.
 
 #include <Arduino.h>
-#include <SoftwareSerial.h>
+
+#include "audioobserver.h"
+#include "eventlog.h"     // events to send when the console has room
+
+// Frames to and from the audio board go in the event log, so tracing them
+// doesn't hold up the bit-banged serial ports.
+enum : uint8_t { EV_AUDIO_SENT, EV_AUDIO_RECEIVED, EV_REMOTE_SHOW };
+void logAudioFrame(uint8_t event, const uint8_t *buf, int len);
+
+template <class Module>
+struct HauntAudioObserver : public VerboseAudioObserver<Module> {
+  static void onMessageReceived(const uint8_t *buf, int len) {
+    logAudioFrame(EV_AUDIO_RECEIVED, buf, len);
+  }
+  static void onMessageSent(const uint8_t *buf, int len) {
+    logAudioFrame(EV_AUDIO_SENT, buf, len);
+  }
+};
+#define AUDIO_OBSERVER HauntAudioObserver
 
 #include "audiomodule.h"  // Catalex or DFPlayer Mini audio player
+#include "binarycommands.h"
 #include "commandbuffer.h"
-#include "fogger.h"
+#include "fastpin.h"
+#include "foggerbank.h"
 #include "lcd_display.h"  // LCD character display
+#include "lightorgan.h"   // audio-reactive lights
 #include "motion.h"       // PIR motion sensor
 #include "msgeq07.h"      // graphic equalizer chip
 #include "parser.h"
 #include "rotaryencoder.h"
+#include "scheduler.h"
+#include "shownet.h"      // RS-485 link to the other props
+#include "timeline.h"     // show cues
+#include "timerserial.h"  // serial ports for the audio board and LCD
+#include "timerwheel.h"   // timers for the LCD and foggers
+
+const char msg_audio_sent[]     PROGMEM = "audio sent % %";
+const char msg_audio_received[] PROGMEM = "audio received % %";
+const char msg_remote_show[]    PROGMEM = "remote show %";
+const char *const messages[] PROGMEM = {
+  msg_audio_sent, msg_audio_received, msg_remote_show
+};
+EventLog<8> event_log(messages);
+
+// The message ID and parameter, from a frame like those in
+// framedmessage.h.
+void logAudioFrame(uint8_t event, const uint8_t *buf, int len) {
+  if (len < 7) return;
+  event_log.record(event, buf[3], (static_cast<uint16_t>(buf[5]) << 8) | buf[6]);
+}
 
 // Devices
-auto serial_for_audio = SoftwareSerial(11, 10);
+TimerWheel timers;
+TimerSerial<10, 11> serial_for_audio;  // TX on 10, RX on 11
 auto audio_board = make_AudioModule(serial_for_audio);
-auto frequency_analyzer = MSGEQ7(12, 13, A0);
-auto rotary_encoder = RotaryEncoder(4, 5, 6, 2, 3);
-auto serial_for_lcd = SoftwareSerial(A2, A3);
-auto lcd = make_LCD(serial_for_lcd);
-auto fogger = Fogger(7, HIGH);
+MediaInventory media_inventory;
+auto frequency_analyzer = make_MSGEQ7(FastPin<12>(), FastPin<13>(), A0);
+auto rotary_encoder = make_RotaryEncoder(FastPin<4>(), FastPin<5>(), 6, 2, 3);
+TimerSerial<A3> serial_for_lcd;  // the LCD only listens
+auto lcd = make_LCD(serial_for_lcd, timers);
+// Haunt Control is the show network's master, so it only transmits.  The
+// RS-485 transceiver's driver enable is on A1.
+TimerSerial<A2> serial_for_network;
+auto network = make_ShowMaster(serial_for_network, FastPin<A1>(), 9600);
+// Add a unit for each fog machine.  Requests go to whichever can make the
+// whole burst first.
+const FogUnit fog_units[] = {
+  //  pin, level, recovery_ms, duty %
+  {     7, HIGH,        5000,     25}
+};
+FoggerBank<1> fogger(fog_units, timers);
+
+// The loud thunder segment is on pin 9, which has PWM, so it follows the
+// rumble.  The other flashes on each clap in the bass.
+const int loud_thunder_pin = 9;
+const int thunder_pin = 8;
+const LightChannel thunder_lights[] = {
+  {loud_thunder_pin, 1, LightChannel::LEVEL},
+  {thunder_pin,      0, LightChannel::FLASH}
+};
+LightOrgan<2> light_organ(thunder_lights);
+
+// While a show has the thunder segments lit, the light organ leaves them
+// alone.  digitalWrite also takes pin 9 off of PWM until the light organ
+// writes it again.
+uint8_t show_lights = 0;
+void setShowLights(uint8_t lights) {
+  show_lights = lights;
+  digitalWrite(loud_thunder_pin, (lights & 0b01) ? HIGH : LOW);
+  digitalWrite(thunder_pin, (lights & 0b10) ? HIGH : LOW);
+}
+
+void runRemoteShow(uint8_t show) {
+  event_log.record(EV_REMOTE_SHOW, show);
+  network.run(show);
+}
+
+// A thunderclap: the track, a flicker of lightning, and fog rolling in
+// behind it.  The raven (show 1 on the network) startles at the clap.
+const Cue thunderclap[] PROGMEM = {
+  cuePlay(     0, 2, 5),
+  cueRemote( 350, 1),
+  cueLights( 400, 0b11),
+  cueLights( 480, 0b00),
+  cueLights( 560, 0b01),
+  cueLights( 620, 0b00),
+  cueFog(   1200, 3000),
+  cueLights(1500, 0b11),
+  cueLights(1650, 0b00),
+  cueEnd(   6000)
+};
+const Cue *const shows[] PROGMEM = { thunderclap };
+auto timeline = Timeline(shows, audio_board, &fogger, setShowLights, runRemoteShow);
+
+Scheduler<9> scheduler;
+CommandBuffer<32, 64> command;
+
+void showStats() {
+  scheduler.printStats(Serial);
+  Serial.print(F("encoder missed: "));
+  Serial.println(rotary_encoder.missedTransitions());
+  Serial.print(F("audio timeouts: "));
+  Serial.println(audio_board.timeouts());
+  Serial.print(F("commands too long: "));
+  Serial.println(command.overflows());
+  Serial.print(F("audio receive errors: "));
+  Serial.println(serial_for_audio.errors());
+  Serial.print(F("fog requests dropped: "));
+  Serial.println(fogger.dropped());
+  Serial.print(F("events lost: "));
+  Serial.println(event_log.lost());
+}
+void showLog() { event_log.dump(); }
+auto binary_commands = BinaryCommands(Serial, audio_board, &fogger);
+void enterBinaryMode() { binary_commands.activate(); }
+
+auto parser = Parser(audio_board, &fogger, showStats, enterBinaryMode, &timeline, showLog);
 
-int constexpr bar_segments[2] = { 9, 8 };
+// The audio board, the LCD, and the network share Timer2 as a bit clock, and the audio
+// board's receiver watches pin 11 with a pin-change interrupt.
+ISR(TIMER2_COMPA_vect) {
+  serial_for_audio.onBitClock();
+  serial_for_lcd.onBitClock();
+  serial_for_network.onBitClock();
+}
+ISR(TIMER2_COMPB_vect) { serial_for_audio.onSample(); }
+ISR(PCINT0_vect) { serial_for_audio.onEdge(); }
 
-CommandBuffer<32> command;
-auto parser = Parser(audio_board, &fogger);
+// The rotary encoder's pins 4 and 5 have PCINT2 to themselves, so it's
+// sampled on every transition.
+ISR(PCINT2_vect) { rotary_encoder.sample(); }
 
 void Format(int x, char *buffer, size_t N) {
 //  static_assert(N > 0, "cannot format to empty buffer");
@@ -49,41 +177,50 @@ void Format(int x, char *buffer, size_t N) {
   while (i > 0) buffer[--i] = ' ';
 }
 
-void setup() {
-  Serial.begin(115200);
-  Serial.println(F("Haunt Control by Hayward Haunter"));
-  Serial.println(F("Copyright 2021 Adrian McCarthy"));
+// Tasks for the scheduler.  Each returns true if it wants to run again
+// right away rather than waiting for its next period.
 
-  lcd.begin();
-  lcd.println(F("Haunt Control"));
-  lcd.print(F("Initializing..."));
+bool pollAudio() {
+  audio_board.update();
+  return false;
+}
 
-  audio_board.begin();
-  fogger.begin();
-  frequency_analyzer.begin();
-  command.begin();
-  rotary_encoder.begin();
+bool pollTimers() {
+  timers.update();
+  return false;
+}
 
-  for (auto i : bar_segments) {
-    pinMode(i, OUTPUT);
-    digitalWrite(i, LOW);
-  }
-  
-  lcd.moveTo(1, 0);
-  lcd.print(F("Ready.          "));
+bool pollFrequencyAnalyzer() {
+  // Keep stepping through the strobe sequence until a frame is complete.
+  if (!frequency_analyzer.update()) return true;
+  if (show_lights) return false;
+  light_organ.update(frequency_analyzer);
+  return false;
 }
 
-void loop() {
-  audio_board.update();
-  fogger.update();
+bool pollTimeline() {
+  timeline.update();
+  return false;
+}
 
-  frequency_analyzer.update();
-  const auto value = frequency_analyzer[1];
-  digitalWrite(bar_segments[0], value > 768 ? HIGH : LOW); // loud thunder
-  digitalWrite(bar_segments[1], value > 384 ? HIGH : LOW); // thunder
-  
+bool pollLog() {
+  // Binary mode has the console to itself.
+  if (binary_commands.active()) return false;
+  // Keep going while the serial port has room.
+  return event_log.update();
+}
+
+bool pollNetwork() {
+  network.update();
+  return false;
+}
+
+bool pollLCD() {
   lcd.update();
+  return false;
+}
 
+bool pollRotaryEncoder() {
   if (rotary_encoder.update()) {
     lcd.moveTo(1, 0);
     lcd.print("Knob: ");
@@ -92,10 +229,59 @@ void loop() {
     Format(rotary_encoder.count(), buf, sizeof(buf));
     lcd.print(buf);
   }
+  return false;
+}
 
+bool pollCommand() {
+  if (binary_commands.active()) return binary_commands.update();
   if (command.available()) {
     if (!parser.parse(command)) {
-      Serial.println("Command not recognized.");
+      Serial.println(F("Command not recognized."));
     }
   }
+  // If more lines are queued, run again right away.
+  return command.pending();
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println(F("Haunt Control by Hayward Haunter"));
+  Serial.println(F("Copyright 2021 Adrian McCarthy"));
+
+  lcd.begin();
+  lcd.println(F("Haunt Control"));
+  lcd.print(F("Initializing..."));
+
+  audio_board.useInventoryCache(media_inventory);
+  audio_board.begin();
+  fogger.begin();
+  serial_for_network.begin(9600);
+  network.begin();
+  frequency_analyzer.begin();
+  command.begin();
+  rotary_encoder.begin();
+  rotary_encoder.enablePinChangeInterrupts();
+
+  // The audio is quiet until the first command, so this is a good time
+  // to measure the noise floor.
+  light_organ.begin();
+  
+  // Periods are in microseconds.  At 115200 baud, the console fills
+  // the 64-byte receive buffer in about 5.5 ms.
+  scheduler.add(pollTimers,             1000, F("timers"));
+  scheduler.add(pollTimeline,           1000, F("timeline"));
+  scheduler.add(pollNetwork,            1000, F("network"));
+  scheduler.add(pollRotaryEncoder,      1000, F("encoder"));
+  scheduler.add(pollAudio,              2000, F("audio"));
+  scheduler.add(pollCommand,            2000, F("command"));
+  scheduler.add(pollLCD,                2000, F("lcd"));
+  scheduler.add(pollFrequencyAnalyzer, 10000, F("msgeq7"));
+  scheduler.add(pollLog,               20000, F("log"));
+
+  lcd.moveTo(1, 0);
+  lcd.print(F("Ready.          "));
+}
+
+void loop() {
+  scheduler.run();
 }
@@ -0,0 +1,9 @@
+// The benchmarks sketch, built for the PC
+
+// The Arduino builder puts the core's header before a sketch, and so do
+// we.  The sketch prints its Timeout checks along with the timings, and
+// ctest fails the run if any of them says FAILED.
+
+#include <Arduino.h>
+
+#include "../benchmarks/benchmarks.ino"
@@ -0,0 +1,73 @@
+// The mock core's definitions, and a `main` that runs a sketch once
+
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+EEPROMClass EEPROM;
+
+namespace {
+  const auto start = std::chrono::steady_clock::now();
+  uint8_t pin_levels[NUM_DIGITAL_PINS];
+}
+
+// Cut to 32 bits, the width of a board's unsigned long.
+unsigned long micros() {
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<uint32_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+unsigned long millis() {
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<uint32_t>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < NUM_DIGITAL_PINS && mode == INPUT_PULLUP) pin_levels[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  if (pin < NUM_DIGITAL_PINS) pin_levels[pin] = level ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < NUM_DIGITAL_PINS ? pin_levels[pin] : LOW;
+}
+
+int analogRead(uint8_t) { return 0; }
+void analogWrite(uint8_t pin, int value) { digitalWrite(pin, value >= 128); }
+
+size_t HardwareSerial::write(uint8_t ch) {
+  // The sketches end lines with CR LF, and a terminal only wants the LF.
+  if (ch != '\r') putchar(ch);
+  return 1;
+}
+
+void HardwareSerial::flush() { fflush(stdout); }
+
+void setup();
+void loop();
+
+// Unlike a board, this runs `loop` just once, so a check or benchmark
+// sketch does its work in `setup` and then exits.
+int main() {
+  setup();
+  loop();
+  Serial.flush();
+  return 0;
+}
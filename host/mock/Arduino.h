@@ -0,0 +1,77 @@
+// A stand-in for the Arduino core, for building the sketches on a PC
+
+// Just enough of the core for the shared headers to compile natively, so
+// their logic can be checked and timed without flashing a board.  The
+// clock comes from the PC's, cut to 32 bits like a board's.  An unsigned
+// long is wider here, though, so a check of rollover needs a 32-bit
+// clock of its own, as in benchmarks.ino.  Pins are a table of levels:
+// digitalWrite sets one, INPUT_PULLUP pulls one high, and digitalRead
+// reads it back.  Serial goes to standard output.
+//
+// This is a board without an AVR, so the shared headers take their
+// portable paths (no SREG, no port registers).
+
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avr/pgmspace.h"
+#include "Print.h"
+#include "Stream.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW  0
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define LED_BUILTIN 13
+#define NUM_DIGITAL_PINS 20
+
+#define bit(b) (1ul << (b))
+
+#define noInterrupts()
+#define interrupts()
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    void end() {}
+    explicit operator bool() const { return true; }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    int availableForWrite() override { return 63; }
+    size_t write(uint8_t ch) override;
+    using Print::write;
+    void flush() override;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
@@ -0,0 +1,36 @@
+// The EEPROM library, backed by an array that starts out erased
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+  public:
+    // The size of an ATmega328P's EEPROM.
+    static constexpr uint16_t SIZE = 1024;
+
+    EEPROMClass() { memset(m_cells, 0xFF, sizeof(m_cells)); }
+
+    uint8_t read(int address) const { return m_cells[address]; }
+    void write(int address, uint8_t value) { m_cells[address] = value; }
+    void update(int address, uint8_t value) { m_cells[address] = value; }
+    uint16_t length() const { return SIZE; }
+
+    template <typename T>
+    T &get(int address, T &value) const {
+      memcpy(&value, m_cells + address, sizeof(T));
+      return value;
+    }
+
+    template <typename T>
+    const T &put(int address, const T &value) {
+      memcpy(m_cells + address, &value, sizeof(T));
+      return value;
+    }
+
+  private:
+    uint8_t m_cells[SIZE];
+};
+
+extern EEPROMClass EEPROM;
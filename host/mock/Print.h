@@ -0,0 +1,70 @@
+// The core's Print, which formats text for anything that writes bytes
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// On a board, F() tags a string in program memory so that print reads it
+// from there.  Here it's an ordinary string with a distinct type.
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+class Print {
+  public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size-- > 0) n += write(*buffer++);
+      return n;
+    }
+    size_t write(const char *str) {
+      return str ? write(reinterpret_cast<const uint8_t *>(str), strlen(str)) : 0;
+    }
+    size_t write(const char *buffer, size_t size) {
+      return write(reinterpret_cast<const uint8_t *>(buffer), size);
+    }
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char ch) { return write(static_cast<uint8_t>(ch)); }
+    size_t print(unsigned char n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(int n, int base = DEC) { return print(static_cast<long>(n), base); }
+    size_t print(unsigned int n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(long n, int base = DEC) {
+      if (base == DEC && n < 0) return print('-') + printNumber(0ul - n, base);
+      return printNumber(n, base);
+    }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+    template <typename T>
+    size_t println(T value, int base) { return print(value, base) + println(); }
+
+  private:
+    // Only the low 32 bits, since a board's longs are that wide.
+    size_t printNumber(unsigned long n, int base) {
+      unsigned long value = static_cast<uint32_t>(n);
+      char buf[33];
+      char *p = buf + sizeof(buf);
+      do {
+        const char digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+      } while (value != 0);
+      return write(p, buf + sizeof(buf) - p);
+    }
+};
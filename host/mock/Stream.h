@@ -0,0 +1,12 @@
+// The core's Stream: a Print that can also be read
+
+#pragma once
+
+#include "Print.h"
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
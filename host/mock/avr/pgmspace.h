@@ -0,0 +1,23 @@
+// Program memory, which on a PC is just memory
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p)  (*reinterpret_cast<const uint8_t *>(p))
+#define pgm_read_word(p)  (*reinterpret_cast<const uint16_t *>(p))
+#define pgm_read_dword(p) (*reinterpret_cast<const uint32_t *>(p))
+// A C-style cast, as in avr-libc, since callers pass pointers to const.
+#define pgm_read_ptr(p)   (*(void *const *)(p))
+#define pgm_read_byte_near(p) pgm_read_byte(p)
+#define pgm_read_word_near(p) pgm_read_word(p)
+
+#define memcpy_P  memcpy
+#define strcpy_P  strcpy
+#define strncpy_P strncpy
+#define strlen_P  strlen
+#define strcmp_P  strcmp
@@ -0,0 +1,85 @@
+// Keyword matching from a table in program memory
+
+// A parser lists its keywords once, as pairs of an ID and a spelling, in
+// a table that lives in flash rather than RAM:
+//
+//     const KeywordEntry<Keyword, 6> MyParser::s_keywords[] PROGMEM = {
+//       {KW_FOG,    "fog"},
+//       {KW_FOLDER, "folder"},
+//       {KW_PLAY,   "play"}
+//     };
+//
+//     Keyword kw = matchKeyword(m_p, s_keywords, KW_UNKNOWN);
+//
+// A word matches a keyword if it spells the whole keyword or an
+// abbreviation that no other keyword shares.  Above, "p" is enough for
+// "play", but "fo" could be either "fog" or "folder", so it's unknown.
+// A word is a run of letters and underscores, so it ends at a digit,
+// space, or punctuation like '?' or '='.  Several spellings can share an
+// ID to make aliases.
+//
+// The WIDTH includes room for the terminator, so it must be one more than
+// the length of the longest keyword (the compiler rejects a spelling that
+// doesn't fit).  The entries must be sorted by spelling, which lets the
+// search stop as soon as it's past the words that could match.
+
+#pragma once
+
+template <typename ID, uint8_t WIDTH>
+struct KeywordEntry {
+  static_assert(sizeof(ID) == 1, "keyword IDs must be a single byte");
+  ID id;
+  char name[WIDTH];
+};
+
+// With FOLD, case is ignored (ASCII only).  With EXACT, the input must
+// match the case of the table, which is a bit smaller and faster if the
+// input has already been normalized.
+enum class KeywordCase : uint8_t { EXACT, FOLD };
+
+namespace keywords {
+  inline bool isWordChar(char ch) {
+    return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ch == '_';
+  }
+
+  inline char fold(char ch) {
+    return ('A' <= ch && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+  }
+
+  inline bool same(char input, char expected, KeywordCase mode) {
+    if (input == expected) return true;
+    return mode == KeywordCase::FOLD && fold(input) == fold(expected);
+  }
+}
+
+// Matches the word at `p` against the table and advances `p` past it.
+// Returns `unknown` if the word doesn't match exactly one keyword.
+template <typename ID, uint8_t WIDTH, size_t N>
+ID matchKeyword(
+  const char *&p,
+  const KeywordEntry<ID, WIDTH> (&table)[N],
+  ID unknown,
+  KeywordCase mode = KeywordCase::EXACT
+) {
+  const char *word = p;
+  while (keywords::isWordChar(*p)) ++p;
+  const uint8_t length = p - word;
+  if (length == 0 || WIDTH <= length) return unknown;
+
+  // Because the table is sorted, the matches are consecutive, and an
+  // exact match comes before any longer keywords it abbreviates.
+  ID found = unknown;
+  for (const auto &entry : table) {
+    uint8_t i = 0;
+    while (i < length && keywords::same(word[i], pgm_read_byte(&entry.name[i]), mode)) ++i;
+    if (i < length) {
+      if (found != unknown) break;
+      continue;
+    }
+    const auto id = static_cast<ID>(pgm_read_byte(&entry.id));
+    if (pgm_read_byte(&entry.name[length]) == '\0') return id;
+    if (found != unknown && found != id) return unknown;
+    found = id;
+  }
+  return found;
+}
@@ -1,48 +1,164 @@
 // Experimenting with laser module
 // Adrian McCarthy 2021
 
-constexpr int laser_pin = 10;  // Pin 10 is OC2A, generated directly from Timer2
+// A Mega drives the laser module from pin 10 (OC2A), so Timer2 generates
+// the strobe (see laserwave.h) while `loop` handles the console and the
+// SerLCD on Serial1.  Commands come from the serial monitor at 115200
+// baud; type HELP for the list.
+
+#include "../basicparser.h"
+#include "../commandbuffer.h"
+#include "../laserwave.h"
+#include "../lcd_display.h"
+#include "../scheduler.h"
+#include "../timerwheel.h"
+
+TimerWheel timers;
+auto lcd = make_LCD(Serial1, timers);
+LaserWave laser;
+CommandBuffer<32, 32, UppercaseCommandPolicy> command;
+Scheduler<4> scheduler;
+
+enum class Keyword : uint8_t {
+  UNKNOWN, HELP, OFF, ON, PULSE, STROBE, SWEEP
+};
+
+class LaserParser : public BasicParser {
+  public:
+    explicit LaserParser(char const *buffer) : BasicParser(buffer) {}
+
+    // CommandBuffer has already converted the command to uppercase, so
+    // the match can be case-sensitive.
+    Keyword parseKeyword() {
+      return parseKeywordFrom(s_keywords, Keyword::UNKNOWN);
+    }
+
+    // Parses a number, returning false if there isn't one.
+    bool parseNumber(unsigned long &value) {
+      SkipWhitespace();
+      if (!MatchDigit()) return false;
+      value = parseUnsignedLong();
+      return true;
+    }
+
+  private:
+    static constexpr uint8_t KEYWORD_COUNT = 6;
+    static const KeywordEntry<Keyword, 7> s_keywords[KEYWORD_COUNT];
+};
+
+// Sorted by spelling.
+KeywordEntry<Keyword, 7> const LaserParser::s_keywords[] PROGMEM = {
+  {Keyword::HELP,   "HELP"},
+  {Keyword::OFF,    "OFF"},
+  {Keyword::ON,     "ON"},
+  {Keyword::PULSE,  "PULSE"},
+  {Keyword::STROBE, "STROBE"},
+  {Keyword::SWEEP,  "SWEEP"}
+};
+
+static void help() {
+  Serial.println(F("\nCommands:"));
+  Serial.println(F(" ON                   - turns on the laser"));
+  Serial.println(F(" OFF                  - turns it off"));
+  Serial.println(F(" STROBE <hz>          - square wave, 31 Hz and up"));
+  Serial.println(F(" PULSE <hz> <duty %>  - pulses at the nearest of 61, 244, 488,"));
+  Serial.println(F("                        976, 1953, 7812, or 62500 Hz"));
+  Serial.println(F(" SWEEP <hz> <hz> <ms> - square wave sweeping back and forth"));
+  Serial.println(F(" HELP                 - shows these instructions"));
+}
+
+// The bottom row of the LCD shows the laser's setting.  Rewriting what's
+// already there costs nothing, so this runs after every command.
+static void showStatus() {
+  lcd.moveTo(1, 0);
+  size_t count = 0;
+  if (!laser.isOpen()) {
+    count += lcd.print(F("Off"));
+  } else if (laser.sweeping()) {
+    count += lcd.print(F("Sweeping"));
+  } else {
+    count += lcd.print(laser.frequency());
+    count += lcd.print(F(" Hz"));
+  }
+  while (count < 16) count += lcd.print(' ');
+}
+
+static bool execute_command(char const *command) {
+  LaserParser parser(command);
+  unsigned long a = 0, b = 0, c = 0;
+  switch (parser.parseKeyword()) {
+    case Keyword::HELP: help(); return true;
+    case Keyword::OFF:  laser.gate(false); return true;
+    case Keyword::ON:   laser.gate(true); return true;
+    case Keyword::PULSE:
+      if (!parser.parseNumber(a) || !parser.parseNumber(b)) return false;
+      laser.setPulses(a, b > 100 ? 100 : b);
+      laser.gate(true);
+      return true;
+    case Keyword::STROBE:
+      if (!parser.parseNumber(a) || !laser.setFrequency(a)) return false;
+      laser.gate(true);
+      return true;
+    case Keyword::SWEEP:
+      if (!parser.parseNumber(a) || !parser.parseNumber(b)) return false;
+      if (!parser.parseNumber(c) || !laser.sweep(a, b, c)) return false;
+      laser.gate(true);
+      return true;
+    default: return false;
+  }
+}
+
+// Tasks for the scheduler.  Each returns true if it wants to run again
+// right away rather than waiting for its next period.
+
+bool pollTimers() {
+  timers.update();
+  return false;
+}
+
+bool pollLaser() {
+  laser.update();
+  return false;
+}
+
+bool pollCommand() {
+  if (command.available()) {
+    Serial.println(command);
+    if (!execute_command(command)) {
+      Serial.println(F("Type HELP for detailed instructions."));
+    }
+    showStatus();
+  }
+  return command.pending();
+}
+
+bool pollLCD() {
+  lcd.update();
+  return false;
+}
 
 void setup() {
   Serial.begin(115200);
   Serial.println(F("Hello, Laser!"));
-  pinMode(laser_pin, OUTPUT);
-  digitalWrite(laser_pin, LOW);
-
-#if 0
-  // Set up Timer2 to generate a square wave on OC2A (pin 10).
-  // Set the Compare On Match unit to Toggle mode (COM2A1=0, COM2A0=1).
-  // Wave Generation Mode is Clear Timer on Compare (CTC).
-  TCCR2A = bit(COM2A0) | bit(WGM21);
-  // We want a frequency of 10kHz.
-  // - Base clock is 16e6 Hz.
-  // - Prescalar of 8 makes Timer 2 tick at 2e6 Hz.
-  // - Count of 100 toggles the pin at 20 kHz.
-  // - Two toggles per period gives a frequency of 10 kHz.
-  // That can be acheived with a prescalar of 8 (CS22=0, CS21=1, CS20=0) ...
-  TCCR2B = bit(CS21);
-  // ... and a count of 100.
-  OCR2A = 100 - 1;  // -1 because it's zero-based
-#endif
-
-  Serial1.begin(9600);
-  delay(500);  // give the display time to boot up
-  Serial1.write(0x12);  // reset to defaults
-  delay(500);
-  Serial1.write(0x7C);
-  Serial1.write(0x04);  // 16 columns
-  delay(500);
-  Serial1.write(0x7C);
-  Serial1.write(0x06);  // 2 rows
-  delay(500);
-  Serial1.write(0x7C);
-  Serial1.write(0x90);  // backlight on about 50%
-  delay(500);
-  Serial1.write(0xFE);
-  Serial1.write(0x01);  // clear and reset cursor
-  Serial1.write("Hello, Laser!");
+
+  // The same 10 kHz as the original experiment, but dark until ON.
+  laser.begin();
+  laser.setFrequency(10000);
+
+  lcd.begin();
+  lcd.setBacklight(50);
+  lcd.print(F("Hello, Laser!"));
+  showStatus();
+
+  command.begin();
+
+  // Periods are in microseconds.
+  scheduler.add(pollTimers,  1000, F("timers"));
+  scheduler.add(pollLaser,   1000, F("laser"));
+  scheduler.add(pollCommand, 2000, F("command"));
+  scheduler.add(pollLCD,     2000, F("lcd"));
 }
 
 void loop() {
-  delay(100);
+  scheduler.run();
 }
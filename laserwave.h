@@ -0,0 +1,180 @@
+// Laser effects from Timer2's waveform generator
+
+// A laser shining through fog onto a spinning mirror (or just a fan)
+// makes a vortex, and strobing the laser makes the vortex's pattern stand
+// still or crawl.  The strobe has to be steady to within a fraction of a
+// period, which the timer can do and `loop` can't, so the waveform comes
+// straight from Timer2's output compare pin, OC2A.  Once it's set up, it
+// runs without the CPU.
+//
+// * A square wave, from about 31 Hz up, uses the fast PWM mode whose top
+//   is OCR2A, toggling OC2A on each match.  OCR2A is double-buffered in
+//   that mode, so a change takes effect at the end of a period, with no
+//   runt or stretched pulses.
+// * Pulses with a duty cycle use the 8-bit fast PWM mode.  OC2A can only
+//   vary its duty cycle when the count runs all the way to 255, so pulses
+//   come at one of the timer's fixed rates: 62500, 7812, 1953, 976, 488,
+//   244, or 61 Hz.
+// * A sweep moves a square wave back and forth between two frequencies.
+//   `update` computes each step and writes OCR2A, and the timer applies
+//   it at the next period boundary, so the steps don't disturb the
+//   waveform.  The prescaler suits the lower frequency and stays put for
+//   the whole sweep, since changing it takes effect immediately.
+// * The gate connects or disconnects OC2A from the pin.  The timer keeps
+//   running while the gate is closed, so the pin just stays low.
+//
+// OC2A is pin 10 on a Mega and pin 11 on an Uno or Pro Mini.  This takes
+// Timer2 away from tone(), analogWrite on its pins, and TimerSerial.
+
+#pragma once
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__) || \
+    defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+class LaserWave {
+  public:
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+    static constexpr int PIN = 10;
+#else
+    static constexpr int PIN = 11;
+#endif
+    static constexpr unsigned long MIN_HZ = 31;
+    static constexpr unsigned long MAX_HZ = F_CPU / 2;
+
+    // Stops the timer, with the gate closed.
+    void begin() {
+      pinMode(PIN, OUTPUT);
+      digitalWrite(PIN, LOW);
+      m_open = false;
+      m_sweeping = false;
+      m_hz = 0;
+      m_wgm_a = 0;
+      m_com = 0;
+      TCCR2A = 0;
+      TCCR2B = 0;
+    }
+
+    // A square wave at `hz`, ending any sweep.  Returns false if `hz` is
+    // out of range.
+    bool setFrequency(unsigned long hz) {
+      if (hz < MIN_HZ || MAX_HZ < hz) return false;
+      m_sweeping = false;
+      const uint8_t cs = prescalerFor(hz);
+      square(cs, countFor(cs, hz));
+      return true;
+    }
+
+    // Pulses of `duty_percent` at the fixed rate nearest to `hz`, ending
+    // any sweep.  Returns the rate.
+    unsigned long setPulses(unsigned long hz, uint8_t duty_percent) {
+      m_sweeping = false;
+      uint8_t cs = 1;
+      unsigned long best = ~0ul;
+      for (uint8_t i = 1; i <= 7; ++i) {
+        const unsigned long rate = F_CPU >> (shiftOf(i) + 8);
+        const unsigned long error = rate > hz ? rate - hz : hz - rate;
+        if (error < best) { best = error; cs = i; }
+      }
+      if (duty_percent > 100) duty_percent = 100;
+      // Even a count of 0 makes a sliver of a pulse, so 0% disconnects.
+      m_com = duty_percent == 0 ? 0 : bit(COM2A1);
+      m_wgm_a = bit(WGM21) | bit(WGM20);
+      OCR2A = (duty_percent * 255u + 50) / 100;
+      TCCR2B = cs;
+      applyGate();
+      m_hz = F_CPU >> (shiftOf(cs) + 8);
+      return m_hz;
+    }
+
+    // Sweeps a square wave from `from_hz` to `to_hz` and back, taking
+    // `ms` each way, until another setting.  Returns false if either
+    // frequency is out of range.
+    bool sweep(unsigned long from_hz, unsigned long to_hz, unsigned long ms) {
+      if (from_hz < MIN_HZ || MAX_HZ < from_hz) return false;
+      if (to_hz < MIN_HZ || MAX_HZ < to_hz) return false;
+      if (ms == 0) return setFrequency(to_hz);
+      m_cs = prescalerFor(from_hz < to_hz ? from_hz : to_hz);
+      m_from = from_hz;
+      m_to = to_hz;
+      m_sweep_ms = ms;
+      m_sweep_start = millis();
+      m_sweeping = true;
+      square(m_cs, countFor(m_cs, from_hz));
+      return true;
+    }
+
+    void gate(bool open) {
+      m_open = open;
+      applyGate();
+    }
+
+    bool isOpen() const { return m_open; }
+    bool sweeping() const { return m_sweeping; }
+
+    // The nominal frequency, in Hz, or 0 before the first setting.
+    unsigned long frequency() const { return m_hz; }
+
+    // Steps a sweep.  Call every millisecond or so.
+    void update() {
+      if (!m_sweeping) return;
+      unsigned long elapsed = millis() - m_sweep_start;
+      const unsigned long cycle = 2 * m_sweep_ms;
+      if (elapsed >= cycle) {
+        // Keep the start recent, so the difference never wraps.
+        m_sweep_start += elapsed - elapsed % cycle;
+        elapsed %= cycle;
+      }
+      const unsigned long t = elapsed < m_sweep_ms ? elapsed : cycle - elapsed;
+      // 256 steps each way is as fine as the 8-bit count can go anyway,
+      // and it keeps the arithmetic within 32 bits.
+      const long fraction = (t * 256) / m_sweep_ms;
+      const long span = static_cast<long>(m_to) - static_cast<long>(m_from);
+      m_hz = m_from + span * fraction / 256;
+      const unsigned long count = countFor(m_cs, m_hz);
+      OCR2A = count - 1;
+    }
+
+  private:
+    // Timer2's prescalers, as shifts, by clock select code.
+    static uint8_t shiftOf(uint8_t cs) {
+      static const uint8_t shifts[] = {0, 3, 5, 6, 7, 8, 10};
+      return shifts[cs - 1];
+    }
+
+    // The finest prescaler whose count covers half a period of `hz`.
+    static uint8_t prescalerFor(unsigned long hz) {
+      uint8_t cs = 1;
+      while (cs < 7 && ((F_CPU >> shiftOf(cs)) / 2) / hz > 256) ++cs;
+      return cs;
+    }
+
+    // Timer ticks in half a period of `hz`, from 1 to 256.
+    static unsigned long countFor(uint8_t cs, unsigned long hz) {
+      const unsigned long count = ((F_CPU >> shiftOf(cs)) / 2 + hz / 2) / hz;
+      return count < 1 ? 1 : count > 256 ? 256 : count;
+    }
+
+    void square(uint8_t cs, unsigned long count) {
+      m_com = bit(COM2A0);  // toggle on each match
+      m_wgm_a = bit(WGM21) | bit(WGM20);
+      OCR2A = count - 1;
+      TCCR2B = bit(WGM22) | cs;
+      applyGate();
+      m_hz = (F_CPU >> shiftOf(cs)) / (2 * count);
+    }
+
+    void applyGate() { TCCR2A = m_wgm_a | (m_open ? m_com : 0); }
+
+    bool m_open = false;
+    bool m_sweeping = false;
+    uint8_t m_wgm_a = 0;
+    uint8_t m_com = 0;
+    uint8_t m_cs = 1;
+    unsigned long m_hz = 0;
+    unsigned long m_from = 0;
+    unsigned long m_to = 0;
+    unsigned long m_sweep_ms = 0;
+    unsigned long m_sweep_start = 0;
+};
+
+#endif
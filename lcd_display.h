@@ -1,22 +1,37 @@
 // Class to control a SparkFun SerLCD display.
 // Adrian McCarthy 2021
 
-class BasicLCD {
+#include "timerwheel.h"
+
+class BasicLCD : public Print {
   public:
-    explicit BasicLCD(Stream &stream) :
+    BasicLCD(Stream &stream, TimerWheel &timers) :
       m_stream(stream),
+      m_timers(timers),
 
       // We don't know the initial backlight brightness setting, so we'll
       // set this to 0, which will force us to acknowledge the first
       // brightness command the caller makes.
       m_brightness(0),
 
+      m_head(0),
+      m_count(0),
+      m_row(0),
+      m_col(0),
+      m_lcd_row(0),
+      m_lcd_col(0),
+      m_cursor_visible(false)
+    {
+      fillShadow();
+    }
+
+    void begin() {
       // On powerup, the display has a splash screen that takes 500 ms.
       // We can't send any commands before that.
-      m_block_until(millis() + 501)
-    {}
-
-    void begin() { clear(); }
+      const auto now = millis();
+      if (now < SPLASH_MS) m_timers.start(m_blocked, SPLASH_MS - now);
+      clear();
+    }
 
     // Set the backlight brightness to a percentage from 0 to 100.
     void setBacklight(int percent) {
@@ -30,32 +45,38 @@ class BasicLCD {
     }
 
     // Clear the display and home the cursor.
-    void clear() { sendCommand(1); }
+    void clear() {
+      sendCommand(1);
+      fillShadow();
+      m_row = m_col = 0;
+      m_lcd_row = m_lcd_col = 0;
+    }
 
     // Hide or show the cursor.
-    void cursorOff() { sendCommand(0x0C); }
-    void cursorOn() { sendCommand(0x0E); }
+    void cursorOff() { sendCommand(0x0C); m_cursor_visible = false; }
+    void cursorOn() { sendCommand(0x0E); m_cursor_visible = true; }
 
     // Move the cursor to a particular row and column (0-based).
     void moveTo(int row, int col) {
       if (row < 0) row = 0;
-      if (row > 1) row = 1;
+      if (row > ROWS - 1) row = ROWS - 1;
       if (col < 0) col = 0;
-      if (col > 15) col = 15;
-      const int pos = 64*row + col + 128;
-      sendCommand(pos);
+      if (col > COLS - 1) col = COLS - 1;
+      m_row = row;
+      m_col = col;
     }
 
+    // Text goes into a shadow copy of the screen, and `update` sends only
+    // the cells that have changed, so these return immediately.  Rewriting
+    // text that's already on the display costs nothing.
     template <typename T>
     size_t print(T data) {
-      waitForReady();
-      return m_stream.print(data);
+      return Print::print(data);
     }
 
     template <typename T>
     size_t println(T data) {
-      waitForReady();
-      const auto count = m_stream.print(data);
+      const auto count = Print::print(data);
       moveTo(1, 0);
       return count;
     }
@@ -68,52 +89,158 @@ class BasicLCD {
       sendCommand(0x18);
     }
 
-    bool update() { return false; }
+    // Call each time through `loop`.  Sends a few queued bytes to the
+    // display, if it's ready for them.  Returns true if it sent anything.
+    bool update() {
+      if (isBlocked()) return false;
+      queueChangedCells();
+      if (m_count == 0) return false;
+      // A hardware UART can tell us how much room it has.  SoftwareSerial
+      // can't, and each byte costs about a millisecond, so we send just
+      // one per call.
+      int budget = m_stream.availableForWrite();
+      if (budget < 1) budget = 1;
+      while (budget-- > 0 && m_count > 0) sendQueuedByte();
+      return true;
+    }
 
-    size_t write(const char *text) {
+    // Blocks until the display matches the shadow copy.
+    void flush() {
       waitForReady();
-      return m_stream.write(text);
+      do {
+        queueChangedCells();
+        while (m_count > 0) sendQueuedByte();
+      } while (m_dirty[0] != 0 || m_dirty[1] != 0);
     }
 
-    size_t write(char ch) {
-      waitForReady();
-      return m_stream.write(&ch, 1);
+    // Writes a character at the cursor and advances it.  Like the SerLCD
+    // itself, running off the end of a row wraps to the other row.
+    size_t write(uint8_t b) override {
+      if (m_shadow[m_row][m_col] != b) {
+        m_shadow[m_row][m_col] = b;
+        m_dirty[m_row] |= cellBit(m_col);
+      }
+      if (++m_col == COLS) {
+        m_col = 0;
+        m_row = (m_row + 1) % ROWS;
+      }
+      return 1;
     }
 
+    using Print::write;
+
   private:
+    static constexpr uint8_t ROWS = 2;
+    static constexpr uint8_t COLS = 16;
+    static constexpr uint8_t UNKNOWN = 0xFF;
+
+    static constexpr uint16_t cellBit(uint8_t col) {
+      return static_cast<uint16_t>(1u << col);
+    }
+
+    void fillShadow() {
+      memset(m_shadow, ' ', sizeof(m_shadow));
+      m_dirty[0] = m_dirty[1] = 0;
+    }
+
+    // Moves changed cells from the shadow into the output queue, as long
+    // as there's room.  Each run of changed cells costs a two-byte cursor
+    // move, unless the display's cursor is already there, so we bridge
+    // single unchanged cells rather than starting a new run.
+    void queueChangedCells() {
+      for (uint8_t row = 0; row < ROWS; ++row) {
+        while (m_dirty[row] != 0) {
+          uint8_t col = 0;
+          while ((m_dirty[row] & cellBit(col)) == 0) ++col;
+          const bool move = (row != m_lcd_row || col != m_lcd_col);
+          if (QUEUE_SIZE - m_count < (move ? 3 : 1)) return;
+          if (move) sendCommand(cursorCommand(row, col));
+          do {
+            enqueue(m_shadow[row][col]);
+            m_dirty[row] &= ~cellBit(col);
+            ++col;
+          } while (col < COLS && m_count < QUEUE_SIZE &&
+                   ((m_dirty[row] >> col) & 0b11) != 0);
+          m_lcd_row = row;
+          // We don't rely on where the display puts the cursor after the
+          // last column.
+          m_lcd_col = (col < COLS) ? col : UNKNOWN;
+        }
+      }
+      if (m_cursor_visible && (m_row != m_lcd_row || m_col != m_lcd_col) &&
+          QUEUE_SIZE - m_count >= 2) {
+        sendCommand(cursorCommand(m_row, m_col));
+        m_lcd_row = m_row;
+        m_lcd_col = m_col;
+      }
+    }
+
+    static constexpr uint8_t cursorCommand(uint8_t row, uint8_t col) {
+      return 64*row + col + 128;
+    }
+
+    void enqueue(uint8_t b) {
+      if (m_count == QUEUE_SIZE) {
+        // Out of room, so we have no choice but to wait.
+        waitForReady();
+        sendQueuedByte();
+      }
+      m_queue[(m_head + m_count) & QUEUE_MASK] = b;
+      ++m_count;
+    }
+
     void sendCommand(char ch) {
-      waitForReady();
-      m_stream.write(0xFE);
-      m_stream.write(ch);
+      enqueue(0xFE);
+      enqueue(ch);
     }
 
     void sendInterfaceCommand(char ch) {
-      waitForReady();
-      m_stream.write(0x7C);
-      m_stream.write(ch);
+      enqueue(0x7C);
+      enqueue(ch);
       // This is not documented, but apparently you need a delay after
       // sending an interface command or the display can lock up.  (Maybe
       // it's just certain commands?)
-      ////m_block_until = millis() + 500;
+      ////m_timers.start(m_blocked, 500);
     }
 
+    bool isBlocked() const { return m_blocked.running(); }
+
     void waitForReady() {
-      // We do not account for rollover after 49 days.
-      const unsigned long now = millis();
-      if (m_block_until > now) {
-        delay(m_block_until - now);
-      }
+      while (isBlocked()) m_timers.update();
     }
 
+    void sendQueuedByte() {
+      m_stream.write(m_queue[m_head]);
+      m_head = (m_head + 1) & QUEUE_MASK;
+      --m_count;
+    }
+
+    // Must be a power of two.  Enough for a full row of text plus a few
+    // cursor moves.
+    static constexpr uint8_t QUEUE_SIZE = 32;
+    static constexpr uint8_t QUEUE_MASK = QUEUE_SIZE - 1;
+
+    static constexpr unsigned long SPLASH_MS = 501;
+
     Stream &m_stream;
+    TimerWheel &m_timers;
     int m_brightness;
-    unsigned long m_block_until;
+    Timer m_blocked;
+    uint8_t m_queue[QUEUE_SIZE];
+    uint8_t m_head;
+    uint8_t m_count;
+    uint8_t m_shadow[ROWS][COLS];  // what the display should show
+    uint16_t m_dirty[ROWS];        // cells not yet sent, one bit per column
+    uint8_t m_row, m_col;          // where the next write goes
+    uint8_t m_lcd_row, m_lcd_col;  // where the display's cursor is
+    bool m_cursor_visible;
 };
 
 template <typename SerialType>
 class LCD : public BasicLCD {
   public:
-    explicit LCD(SerialType &serial) : BasicLCD(serial), m_serial(serial) {}
+    LCD(SerialType &serial, TimerWheel &timers) :
+      BasicLCD(serial, timers), m_serial(serial) {}
     void begin() {
       m_serial.begin(9600);
       BasicLCD::begin();
@@ -123,6 +250,6 @@ class LCD : public BasicLCD {
 };
 
 template <typename SerialType>
-LCD<SerialType> make_LCD(SerialType &serial) {
-  return LCD<SerialType>(serial);
+LCD<SerialType> make_LCD(SerialType &serial, TimerWheel &timers) {
+  return LCD<SerialType>(serial, timers);
 }
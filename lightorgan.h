@@ -0,0 +1,191 @@
+// Audio-reactive lights driven by an MSGEQ7
+
+// Each frame from the MSGEQ7 goes through a few stages:
+//
+// 1. The noise floor is subtracted from each band.  The floor is the loudest
+//    reading seen while calibrating, which should be done while the audio
+//    is silent (e.g., before the first track starts).  The remaining range
+//    is stretched to full scale by a gain worked out at the same time.
+// 2. Each band follows an envelope with a fast attack and a slow release,
+//    so a light jumps with a thunderclap and fades out behind it rather
+//    than flickering with every wiggle of the signal.
+// 3. An onset is when a band's envelope jumps well above its own recent
+//    average.  An onset in one of the beat bands (the bass, by default) is
+//    a beat.
+// 4. Each output channel shows one band, either as a brightness that
+//    follows the envelope (LEVEL) or as a flash on each onset that decays
+//    (FLASH).  Outputs are written with analogWrite, so on a pin without
+//    PWM they're just on or off: on from a value of 128 up.
+//
+// The envelopes are 16-bit fixed point, with 0xFFFF as full scale.  The
+// attack and release are shifts, and the only divisions happen once at
+// the end of calibration, so a frame is cheap even on an 8-bit processor.
+//
+//     const LightChannel lights[] = {
+//       {9, 1, LightChannel::LEVEL},
+//       {8, 0, LightChannel::FLASH}
+//     };
+//     LightOrgan<2> organ(lights);
+//     ...
+//     organ.begin();  // calibrates over the first 64 frames
+//     ...
+//     if (analyzer.update()) organ.update(analyzer);
+
+#pragma once
+
+struct LightChannel {
+  enum Mode : uint8_t { LEVEL, FLASH };
+  uint8_t pin;
+  uint8_t band;  // 0 (63 Hz) through 6 (16 kHz)
+  Mode mode;
+};
+
+template <uint8_t CHANNELS>
+class LightOrgan {
+  public:
+    static constexpr uint8_t BANDS = 7;
+
+    // The channels must outlive the LightOrgan.
+    explicit LightOrgan(const LightChannel (&channels)[CHANNELS]) :
+      m_channels(channels) {}
+
+    void begin(uint8_t calibration_frames = 64) {
+      for (uint8_t i = 0; i < CHANNELS; ++i) {
+        pinMode(m_channels[i].pin, OUTPUT);
+        m_flash[i] = 0;
+      }
+      calibrate(calibration_frames);
+    }
+
+    // The shifts set how quickly the envelopes rise and fall and how long
+    // the average that onsets are measured against is: each frame closes
+    // 1/2^shift of the gap.  With frames every 10 ms, the defaults rise
+    // within a couple of frames and fall over about 150 ms.
+    void configure(uint8_t attack_shift, uint8_t release_shift, uint8_t average_shift) {
+      m_attack_shift = attack_shift;
+      m_release_shift = release_shift;
+      m_average_shift = average_shift;
+    }
+
+    // Picks the bands that count as beats, one bit per band.
+    void setBeatBands(uint8_t bands) { m_beat_bands = bands; }
+
+    // Measures the noise floor over the next `frames` frames.  The outputs
+    // stay dark until it's done.
+    void calibrate(uint8_t frames = 64) {
+      for (uint8_t b = 0; b < BANDS; ++b) {
+        m_floor[b] = 0;
+        m_envelope[b] = m_average[b] = 0;
+        m_holdoff[b] = 0;
+      }
+      m_calibrating = frames;
+      if (frames == 0) computeGains();
+      writeOutputs();
+    }
+
+    bool calibrating() const { return m_calibrating != 0; }
+
+    // Processes one frame.  `bands` is anything that returns the band
+    // readings (0 to 1023) with operator[], like an MSGEQ7.
+    template <class Analyzer>
+    void update(const Analyzer &bands) {
+      m_onsets = 0;
+      if (m_calibrating != 0) {
+        for (uint8_t b = 0; b < BANDS; ++b) {
+          const int value = bands[b];
+          if (value > m_floor[b]) m_floor[b] = value;
+        }
+        if (--m_calibrating == 0) computeGains();
+        return;
+      }
+
+      for (uint8_t b = 0; b < BANDS; ++b) {
+        const int value = bands[b] - m_floor[b];
+        const uint32_t scaled = value > 0 ? static_cast<uint32_t>(value) * m_gain[b] : 0;
+        const uint16_t level = scaled > 0xFFFF ? 0xFFFF : scaled;
+
+        uint16_t &envelope = m_envelope[b];
+        const bool rising = level > envelope;
+        if (rising) {
+          // Rounded up, so it always reaches the level.  In 32 bits, since
+          // the rounding would overflow a 16-bit int on a big jump.
+          const uint32_t rounding = (1ul << m_attack_shift) - 1;
+          envelope += (static_cast<uint32_t>(level - envelope) + rounding) >> m_attack_shift;
+        } else {
+          envelope -= (envelope - level) >> m_release_shift;
+        }
+
+        // An onset is a rise to half again over the recent average.  After
+        // one, the band ignores the next few frames, so a single
+        // thunderclap doesn't register as several.
+        uint16_t &average = m_average[b];
+        if (m_holdoff[b] != 0) {
+          --m_holdoff[b];
+        } else if (rising && envelope > MIN_ONSET && envelope > average &&
+                   envelope - average > (average >> 1)) {
+          m_onsets |= 1 << b;
+          m_holdoff[b] = HOLDOFF_FRAMES;
+        }
+        if (envelope > average) {
+          average += (envelope - average) >> m_average_shift;
+        } else {
+          average -= (average - envelope) >> m_average_shift;
+        }
+      }
+      writeOutputs();
+    }
+
+    uint16_t envelope(uint8_t band) const { return m_envelope[band]; }
+    int noiseFloor(uint8_t band) const { return m_floor[band]; }
+
+    // The bands that had an onset in the latest frame, one bit per band.
+    uint8_t onsets() const { return m_onsets; }
+    bool beat() const { return (m_onsets & m_beat_bands) != 0; }
+
+    // The brightness of channel `i` as of the latest frame.
+    uint8_t brightness(uint8_t i) const {
+      const auto &channel = m_channels[i];
+      return channel.mode == LightChannel::FLASH ? m_flash[i] : m_envelope[channel.band] >> 8;
+    }
+
+  private:
+    // Below about 3% of full scale, nothing counts as an onset.
+    static constexpr uint16_t MIN_ONSET = 0x0800;
+    static constexpr uint8_t HOLDOFF_FRAMES = 8;
+
+    void computeGains() {
+      for (uint8_t b = 0; b < BANDS; ++b) {
+        const int range = 1023 - m_floor[b];
+        m_gain[b] = range > 0 ? 0xFFFFu / range : 0;
+      }
+    }
+
+    void writeOutputs() {
+      for (uint8_t i = 0; i < CHANNELS; ++i) {
+        const auto &channel = m_channels[i];
+        if (channel.mode == LightChannel::FLASH) {
+          uint8_t &flash = m_flash[i];
+          if (m_onsets & (1 << channel.band)) {
+            flash = 255;
+          } else if (flash != 0) {
+            flash -= (flash >> 2) + 1;  // half brightness in about three frames
+          }
+        }
+        analogWrite(channel.pin, m_calibrating ? 0 : brightness(i));
+      }
+    }
+
+    const LightChannel *m_channels;
+    uint8_t m_attack_shift = 1;
+    uint8_t m_release_shift = 4;
+    uint8_t m_average_shift = 4;
+    uint8_t m_beat_bands = 0b0000011;
+    uint8_t m_calibrating = 0;
+    uint8_t m_onsets = 0;
+    int m_floor[BANDS];
+    uint16_t m_gain[BANDS];
+    uint16_t m_envelope[BANDS];
+    uint16_t m_average[BANDS];
+    uint8_t m_holdoff[BANDS];
+    uint8_t m_flash[CHANNELS];
+};
@@ -0,0 +1,51 @@
+// The audio module's media inventory, remembered in EEPROM
+
+// Initializing an audio module means asking it about each storage device,
+// and every question it can't answer costs a timeout, so the full
+// sequence can take a couple of seconds.  The answers rarely change
+// between power cycles, so BasicAudioModule can save them here and then
+// check just the one that identifies the card (see `useInventoryCache`).
+//
+// The signature is the set of devices the module reports online after a
+// reset, plus the file count of the selected device.  If either differs,
+// the module falls back to the full sequence and saves the new results.
+
+#pragma once
+
+#include "parameters.h"
+
+// It's saved only when the card changes, so a few slots are plenty.
+class MediaInventory : public Parameters<4, 0x4D49, 1, 8> {
+  public:
+    enum Index : uint8_t { DEVICES, SOURCE, FILES, FOLDERS };
+
+    // `devices` is the raw mask from the module's init-complete message.
+    uint8_t devices() const { return get_by_index(DEVICES); }
+    uint8_t source() const { return get_by_index(SOURCE); }
+    uint16_t files() const { return get_by_index(FILES); }
+    uint8_t folders() const { return get_by_index(FOLDERS); }
+
+    void record(uint8_t devices, uint8_t source, uint16_t files, uint8_t folders) {
+      load_defaults();  // in case the cache didn't load
+      set_by_index(DEVICES, devices);
+      set_by_index(SOURCE, source);
+      set_by_index(FILES, files);
+      set_by_index(FOLDERS, folders);
+    }
+
+  private:
+    bool do_load_defaults() override { return true; }
+
+    // Anything with files counts.  The device numbers are checked by the
+    // module, which knows what they mean.
+    bool do_sane() const override { return files() > 0; }
+
+    void do_print_name(uint8_t i) const override {
+      switch (i) {
+        case DEVICES: Serial.print(F("devices")); break;
+        case SOURCE:  Serial.print(F("source"));  break;
+        case FILES:   Serial.print(F("files"));   break;
+        case FOLDERS: Serial.print(F("folders")); break;
+      }
+    }
+};
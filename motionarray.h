@@ -0,0 +1,213 @@
+// An array of motion sensors, debounced together
+
+// Up to eight sensors are sampled at once as the bits of a byte, and all
+// of them are debounced in parallel with a vertical counter: two bytes
+// hold a 2-bit counter for each sensor, so a sensor's debounced state
+// changes only after four consecutive samples disagree with it.  That
+// takes a handful of bitwise operations per update, no matter how many
+// sensors there are.
+//
+// Each debounced edge is pushed into a small queue as a timestamped
+// MotionEvent, so several consumers (a trigger, a fogger, a log) can
+// react to motion without each polling the pins.  If nobody drains the
+// queue, new events are dropped and counted.
+//
+// Fusion rules combine sensors.  A rule fires when at least `quorum` of
+// the sensors in its set have started detecting motion within `window`
+// milliseconds of each other, e.g., two out of three.  That filters out
+// the false triggers a single sensor produces on its own.  Once it fires,
+// a rule stays quiet for one more window.
+//
+//     auto motion = make_MotionArray(PinInputs(pins, 3));
+//     motion.addRule(0b111, 2, 200);
+//     ...
+//     motion.update();  // every 5 ms or so
+//     MotionEvent event;
+//     while (motion.read(event)) { ... }
+//
+// The debounce time is four times the update period.  PIR sensors hold
+// their outputs for a second or more, so 5 to 10 ms is plenty.
+
+#pragma once
+
+#include "fastpin.h"
+
+struct MotionEvent {
+  enum Kind : uint8_t { STARTED, STOPPED, RULE };
+  Kind kind;
+  uint8_t index;  // the sensor's bit, or the rule's index
+  unsigned long time;
+};
+
+// Reads sensors on arbitrary pins.  Sensor i is the i-th pin in the list,
+// which must outlive the PinInputs.
+class PinInputs {
+  public:
+    PinInputs(const uint8_t *pins, uint8_t count, bool active_low = false) :
+      m_pins(pins), m_count(count), m_invert(active_low ? 0xFF : 0x00) {}
+
+    void begin() const {
+      for (uint8_t i = 0; i < m_count; ++i) pinMode(m_pins[i], INPUT);
+    }
+
+    uint8_t mask() const { return static_cast<uint8_t>((1u << m_count) - 1); }
+
+    uint8_t read() const {
+      uint8_t bits = 0;
+      for (uint8_t i = 0; i < m_count; ++i) {
+        if (digitalRead(m_pins[i]) == HIGH) bits |= 1 << i;
+      }
+      return (bits ^ m_invert) & mask();
+    }
+
+  private:
+    const uint8_t *m_pins;
+    uint8_t m_count;
+    uint8_t m_invert;
+};
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+// Reads the sensors wired to one port in a single instruction.  A sensor's
+// index is its bit within the port, so sensors on pins 2, 3, and 5 (PORTD)
+// are 2, 3, and 5.
+template <fastpin::Port PORT, uint8_t MASK, bool ACTIVE_LOW = false>
+class PortInputs {
+  public:
+    void begin() const { Regs::ddr() &= ~MASK; Regs::out() &= ~MASK; }
+    static constexpr uint8_t mask() { return MASK; }
+    uint8_t read() const { return (ACTIVE_LOW ? ~Regs::in() : Regs::in()) & MASK; }
+
+  private:
+    typedef fastpin::Registers<PORT> Regs;
+};
+
+#endif
+
+template <class Inputs, uint8_t QUEUE_SIZE = 8, uint8_t MAX_RULES = 2>
+class MotionArray {
+  public:
+    static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "QUEUE_SIZE must be a power of 2");
+
+    explicit MotionArray(Inputs inputs) : m_inputs(inputs) {}
+
+    // Sensors that are already detecting motion start out that way, without
+    // an event.
+    void begin() {
+      m_inputs.begin();
+      m_state = m_inputs.read();
+      m_count0 = m_count1 = 0xFF;
+    }
+
+    // Returns false if there's no room for another rule.
+    bool addRule(uint8_t sensors, uint8_t quorum, uint16_t window_ms) {
+      if (m_rule_count == MAX_RULES) return false;
+      auto &rule = m_rules[m_rule_count++];
+      rule.sensors = sensors & m_inputs.mask();
+      rule.quorum = quorum;
+      rule.window = window_ms;
+      rule.armed = true;
+      return true;
+    }
+
+    // Samples all the sensors once.  Call at a steady rate.
+    void update() {
+      const auto now = millis();
+      uint8_t changed = m_state ^ m_inputs.read();
+      // Each changed bit counts down from 3; an unchanged bit resets.
+      m_count0 = ~(m_count0 & changed);
+      m_count1 = m_count0 ^ (m_count1 & changed);
+      changed &= m_count0 & m_count1;
+      if (changed == 0) return;
+      m_state ^= changed;
+
+      const uint8_t started = changed & m_state;
+      for (uint8_t i = 0; i < 8; ++i) {
+        const uint8_t bit = 1 << i;
+        if ((changed & bit) == 0) continue;
+        if (started & bit) m_started_at[i] = now;
+        push(started & bit ? MotionEvent::STARTED : MotionEvent::STOPPED, i, now);
+      }
+      m_recent |= started;
+      if (started) checkRules(started, now);
+    }
+
+    // Takes the oldest event from the queue.  Returns false if the queue
+    // is empty.
+    bool read(MotionEvent &event) {
+      if (m_count == 0) return false;
+      event = m_queue[m_head];
+      m_head = (m_head + 1) & QUEUE_MASK;
+      --m_count;
+      return true;
+    }
+
+    // The debounced state of all the sensors, one bit per sensor.
+    uint8_t state() const { return m_state; }
+    bool motion(uint8_t index) const { return (m_state >> index) & 1; }
+
+    // The number of events dropped because the queue was full.
+    unsigned dropped() const { return m_dropped; }
+
+  private:
+    static constexpr uint8_t QUEUE_MASK = QUEUE_SIZE - 1;
+
+    struct Rule {
+      uint8_t sensors;
+      uint8_t quorum;
+      uint16_t window;
+      bool armed;
+      unsigned long fired_at;
+    };
+
+    void push(MotionEvent::Kind kind, uint8_t index, unsigned long now) {
+      if (m_count == QUEUE_SIZE) { ++m_dropped; return; }
+      m_queue[(m_head + m_count) & QUEUE_MASK] = MotionEvent{kind, index, now};
+      ++m_count;
+    }
+
+    void checkRules(uint8_t started, unsigned long now) {
+      for (uint8_t r = 0; r < m_rule_count; ++r) {
+        auto &rule = m_rules[r];
+        if (!rule.armed) {
+          if (now - rule.fired_at < rule.window) continue;
+          rule.armed = true;
+        }
+        if ((started & rule.sensors) == 0) continue;
+        uint8_t votes = 0;
+        for (uint8_t i = 0; i < 8; ++i) {
+          if ((rule.sensors & (1 << i)) == 0) continue;
+          // A sensor that's already gone quiet still counts if it started
+          // recently.
+          if ((m_recent & (1 << i)) == 0) continue;
+          const auto age = now - m_started_at[i];
+          if (age <= rule.window) ++votes;
+          // Past every possible window, the time is stale, and it would
+          // eventually look recent again when millis() rolls over.
+          if (age > 0xFFFF) m_recent &= ~(1 << i);
+        }
+        if (votes < rule.quorum) continue;
+        rule.armed = false;
+        rule.fired_at = now;
+        push(MotionEvent::RULE, r, now);
+      }
+    }
+
+    Inputs m_inputs;
+    uint8_t m_state = 0;
+    uint8_t m_count0 = 0xFF;
+    uint8_t m_count1 = 0xFF;
+    uint8_t m_recent = 0;  // sensors whose m_started_at may be within a window
+    unsigned long m_started_at[8];
+    Rule m_rules[MAX_RULES];
+    uint8_t m_rule_count = 0;
+    MotionEvent m_queue[QUEUE_SIZE];
+    uint8_t m_head = 0;
+    uint8_t m_count = 0;
+    unsigned m_dropped = 0;
+};
+
+template <class Inputs>
+MotionArray<Inputs> make_MotionArray(Inputs inputs) {
+  return MotionArray<Inputs>(inputs);
+}
@@ -4,51 +4,151 @@
 // This chip measures output power in seven frequency bands (e.g., to
 // produce a display like a graphic equalizer).
 
+#include "fastpin.h"
+#include "timeout.h"
+
+template <typename ResetPin = DigitalPin, typename StrobePin = DigitalPin>
 class MSGEQ7 {
   public:
     // Driving the chip requires two digital output pins, reset and strobe.
     // Data is collected from a single analog input pin, data.
-    MSGEQ7(int reset_pin, int strobe_pin, int data_pin) :
+    //
+    // The reset and strobe pins can be plain pin numbers or `FastPin`s.
+    MSGEQ7(ResetPin reset_pin, StrobePin strobe_pin, int data_pin) :
       m_reset_pin(reset_pin),
       m_strobe_pin(strobe_pin),
-      m_data_pin(data_pin) {}
- 
+      m_data_pin(data_pin),
+      m_phase(PH_RESET),
+      m_band(0),
+      m_front(0) {}
+
     void begin() {
-      pinMode(m_reset_pin, OUTPUT);
-      digitalWrite(m_reset_pin, LOW);
-      pinMode(m_strobe_pin, OUTPUT);
-      digitalWrite(m_strobe_pin, LOW);
+      m_reset_pin.output();
+      m_reset_pin.low();
+      m_strobe_pin.output();
+      m_strobe_pin.low();
       pinMode(m_data_pin, INPUT);
-      for (auto &c : m_channels) c = 0;
+      for (auto &frame : m_channels) {
+        for (auto &c : frame) c = 0;
+      }
+      m_front = 0;
+      m_band = 0;
+      m_phase = PH_RESET;
+      m_timer.set(0);
     }
 
-    void update() {
-      digitalWrite(m_reset_pin, HIGH);
-      digitalWrite(m_strobe_pin, HIGH);
-      delayMicroseconds(18);
-      digitalWrite(m_strobe_pin, LOW);
-      delayMicroseconds(18);
-      digitalWrite(m_strobe_pin, HIGH);
-      digitalWrite(m_reset_pin, LOW);
-      delayMicroseconds(18);
-      for (int i = 0; i < 7; ++i) {
-        digitalWrite(m_strobe_pin, LOW);
-        delayMicroseconds(36);
-        m_channels[i] = analogRead(m_data_pin);
-        digitalWrite(m_strobe_pin, HIGH);
-        delayMicroseconds(36);
+    // Call each time through `loop`.
+    //
+    // Rather than running the entire reset and strobe sequence at once,
+    // each call advances the sequence by at most one step and returns
+    // immediately if the chip's timing requirements haven't yet been met.
+    // The analog conversion is started in one call and collected in a
+    // later one, so we never sit in `analogRead` either.
+    //
+    // Returns true when a complete new set of bands has been published.
+    bool update() {
+      switch (m_phase) {
+        case PH_RESET:
+          if (!m_timer.expired()) return false;
+          m_reset_pin.high();
+          m_strobe_pin.high();
+          return wait(PH_RESET_STROBE, 18);
+        case PH_RESET_STROBE:
+          if (!m_timer.expired()) return false;
+          m_strobe_pin.low();
+          return wait(PH_RESET_DONE, 18);
+        case PH_RESET_DONE:
+          if (!m_timer.expired()) return false;
+          m_strobe_pin.high();
+          m_reset_pin.low();
+          m_band = 0;
+          return wait(PH_STROBE, 18);
+        case PH_STROBE:
+          if (!m_timer.expired()) return false;
+          m_strobe_pin.low();
+          // The output needs time to settle after the strobe falls.
+          return wait(PH_CONVERT, 36);
+        case PH_CONVERT:
+          if (!m_timer.expired()) return false;
+          startConversion();
+          m_phase = PH_READ;
+          return false;
+        case PH_READ: {
+          if (!conversionComplete()) return false;
+          m_channels[m_front ^ 1][m_band] = conversionResult();
+          m_strobe_pin.high();
+          if (++m_band < 7) return wait(PH_STROBE, 36);
+          // The back buffer now holds a complete frame, so we flip it to
+          // the front.  Readers never see a mix of old and new bands.
+          m_front ^= 1;
+          wait(PH_RESET, 36);
+          return true;
+        }
       }
+      m_phase = PH_RESET;
+      return false;
     }
 
     int operator[] (int n) const {
       if (n < 0) return 0;
       if (7 <= n) return 0;
-      return m_channels[n];
+      return m_channels[m_front][n];
     }
 
   private:
-    int m_reset_pin;
-    int m_strobe_pin;
+    enum Phase : uint8_t {
+      PH_RESET, PH_RESET_STROBE, PH_RESET_DONE, PH_STROBE, PH_CONVERT, PH_READ
+    };
+
+    bool wait(Phase next, unsigned microseconds) {
+      m_phase = next;
+      m_timer.set(microseconds);
+      return false;
+    }
+
+#if defined(ADCSRA) && defined(ADSC)
+    // On AVR, we drive the ADC registers directly so that we can start a
+    // conversion and come back for the result later.  This assumes the
+    // default (AVcc) analog reference, which is what `analogRead` uses
+    // unless `analogReference` has been called.  Nothing else should do
+    // an `analogRead` while a conversion is in flight.
+    void startConversion() {
+      uint8_t channel = m_data_pin;
+      if (channel >= A0) channel -= A0;
+#if defined(MUX5)
+      ADCSRB = (ADCSRB & ~bit(MUX5)) | ((channel & 0x08) ? bit(MUX5) : 0);
+#endif
+      ADMUX = bit(REFS0) | (channel & 0x07);
+      ADCSRA |= bit(ADSC);
+    }
+
+    bool conversionComplete() const { return (ADCSRA & bit(ADSC)) == 0; }
+
+    int conversionResult() const {
+      // ADCL must be read before ADCH.
+      const uint8_t lo = ADCL;
+      const uint8_t hi = ADCH;
+      return (static_cast<int>(hi) << 8) | lo;
+    }
+#else
+    // Elsewhere, we fall back to a plain blocking `analogRead`.
+    void startConversion() { m_result = analogRead(m_data_pin); }
+    bool conversionComplete() const { return true; }
+    int conversionResult() const { return m_result; }
+    int m_result = 0;
+#endif
+
+    ResetPin m_reset_pin;
+    StrobePin m_strobe_pin;
     int m_data_pin;
-    int m_channels[7];
+    Phase m_phase;
+    uint8_t m_band;
+    uint8_t m_front;  // index of the frame readers see
+    Timeout<MicrosClock> m_timer;
+    int m_channels[2][7];
 };
+
+template <typename ResetPin, typename StrobePin>
+MSGEQ7<ResetPin, StrobePin> make_MSGEQ7(ResetPin reset_pin, StrobePin strobe_pin, int data_pin) {
+  return MSGEQ7<ResetPin, StrobePin>(reset_pin, strobe_pin, data_pin);
+}
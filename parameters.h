@@ -0,0 +1,202 @@
+// Prop settings that can be saved to EEPROM
+
+// A prop derives from Parameters to supply the defaults, a sanity check,
+// and the names of its settings.  The values are longs, indexed by number,
+// and the derived class typically wraps them with typed accessors.
+//
+// The settings take up `eeprom_size()` bytes of EEPROM from the base
+// address passed to the load and save functions, so a sketch with more
+// than one store can put each one after the last.
+
+#pragma once
+
+#include <EEPROM.h>
+
+template <uint8_t COUNT, int MAGIC, int VERSION, uint8_t SLOTS>
+class Parameters {
+  public:
+    bool load_defaults() {
+      memset(m_values, 0, sizeof(m_values));
+      if (!do_load_defaults()) {
+        return false;
+      }
+      m_version = VERSION;
+      return true;
+    }
+
+    bool sane() const {
+      return (m_version == VERSION) && do_sane();
+    }
+
+    // The settings are saved as a journal of SLOTS records that rotate
+    // from the base address, so repeated saves don't wear out any one
+    // cell.  Each
+    // record has a sequence number and a CRC.  Loading picks the newest
+    // intact record, so a save cut short by a power loss just leaves the
+    // previous settings in effect.
+    bool load_from_eeprom(int base_address = 0) {
+      uint16_t sequence = 0;
+      int const slot = find_newest(base_address, sequence);
+      if (slot < 0) return false;  // never been saved
+
+      auto addr = slot_address(base_address, slot);
+      Header header;
+      EEPROM.get(addr, header); addr += sizeof(header);
+      m_version = header.version;
+      if (m_version <= 0) return false;
+
+      auto *p = reinterpret_cast<uint8_t *>(m_values);
+      for (unsigned i = 0; i < sizeof(m_values); ++i) {
+        *p++ = EEPROM.read(addr++);
+      }
+
+      return m_version == VERSION;
+    }
+
+    bool save_to_eeprom(int base_address = 0) const {
+      uint16_t sequence = 0;
+      int slot = find_newest(base_address, sequence);
+      if (slot >= 0 && matches(slot_address(base_address, slot))) {
+        return true;  // nothing has changed
+      }
+      // With no previous record, this starts at slot 0.
+      slot = (slot + 1) % slot_count(base_address);
+
+      Header const header = { MAGIC, static_cast<uint16_t>(sequence + 1), m_version };
+      auto addr = slot_address(base_address, slot);
+      uint16_t crc = 0xFFFF;
+      // EEPROM.update skips bytes that already have the right value, and
+      // writing the CRC last means a partial record won't validate.
+      auto const *p = reinterpret_cast<uint8_t const *>(&header);
+      for (unsigned i = 0; i < sizeof(header); ++i) {
+        crc = crc16(crc, *p);
+        EEPROM.update(addr++, *p++);
+      }
+      p = reinterpret_cast<uint8_t const *>(m_values);
+      for (unsigned i = 0; i < sizeof(m_values); ++i) {
+        crc = crc16(crc, *p);
+        EEPROM.update(addr++, *p++);
+      }
+      EEPROM.put(addr, crc);
+
+      // Read it back to be sure it took.
+      return record_crc(slot_address(base_address, slot)) == crc;
+    }
+
+    void clear_eeprom(int base_address = 0) {
+      // All we have to do is wipe out the magic numbers.
+      int const signature = !MAGIC;
+      for (int slot = 0; slot < slot_count(base_address); ++slot) {
+        auto const addr = slot_address(base_address, slot);
+        int magic = 0;
+        if (EEPROM.get(addr, magic) == MAGIC) EEPROM.put(addr, signature);
+      }
+    }
+
+    // The bytes of EEPROM the journal occupies.
+    static constexpr int eeprom_size() { return SLOTS*RECORD_SIZE; }
+
+    void print_name(uint8_t i) {
+      if (i >= COUNT) return;
+      do_print_name(i);
+    }
+
+    void show() const {
+      for (uint8_t i = 0; i < COUNT; ++i) {
+        Serial.print(F(" "));
+        do_print_name(i);
+        Serial.print(F(" = "));
+        Serial.println(m_values[i]);
+      }
+    }
+
+  protected:
+    long get_by_index(uint8_t i) const {
+      return (i < COUNT) ? m_values[i] : 0L;
+    }
+
+    bool set_by_index(uint8_t i, long value) {
+      if (i < COUNT) {
+        m_values[i] = value;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    struct Header {
+      int magic;
+      uint16_t sequence;
+      int version;
+    };
+
+    static constexpr int RECORD_SIZE =
+      sizeof(Header) + COUNT*sizeof(long) + sizeof(uint16_t);
+
+    // SLOTS, unless the EEPROM ends first.
+    static int slot_count(int base_address) {
+      int const fit = (EEPROM.length() - base_address) / RECORD_SIZE;
+      return fit < SLOTS ? fit : SLOTS;
+    }
+
+    static int slot_address(int base_address, int slot) {
+      return base_address + slot*RECORD_SIZE;
+    }
+
+    // CRC-16/CCITT, one byte at a time.
+    static uint16_t crc16(uint16_t crc, uint8_t b) {
+      crc ^= static_cast<uint16_t>(b) << 8;
+      for (uint8_t i = 0; i < 8; ++i) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+      }
+      return crc;
+    }
+
+    // The CRC of the header and values of the record at `addr`, as they
+    // are in the EEPROM.
+    static uint16_t record_crc(int addr) {
+      uint16_t crc = 0xFFFF;
+      for (int i = 0; i < RECORD_SIZE - 2; ++i) crc = crc16(crc, EEPROM.read(addr + i));
+      return crc;
+    }
+
+    // Scans all the slots for intact records and returns the slot of the
+    // one with the highest sequence number, or -1 if there are none.
+    static int find_newest(int base_address, uint16_t &sequence) {
+      int newest = -1;
+      for (int slot = 0; slot < slot_count(base_address); ++slot) {
+        auto const addr = slot_address(base_address, slot);
+        Header header;
+        EEPROM.get(addr, header);
+        if (header.magic != MAGIC) continue;
+        uint16_t crc = 0;
+        EEPROM.get(addr + RECORD_SIZE - 2, crc);
+        if (record_crc(addr) != crc) continue;
+        // The signed difference handles the sequence number wrapping.
+        if (newest < 0 || static_cast<int16_t>(header.sequence - sequence) > 0) {
+          newest = slot;
+          sequence = header.sequence;
+        }
+      }
+      return newest;
+    }
+
+    // True if the record at `addr` already holds the current settings.
+    bool matches(int addr) const {
+      Header header;
+      EEPROM.get(addr, header); addr += sizeof(header);
+      if (header.version != m_version) return false;
+      auto const *p = reinterpret_cast<uint8_t const *>(m_values);
+      for (unsigned i = 0; i < sizeof(m_values); ++i) {
+        if (EEPROM.read(addr++) != *p++) return false;
+      }
+      return true;
+    }
+
+    virtual bool do_load_defaults() = 0;
+    virtual bool do_sane() const = 0;
+    virtual void do_print_name(uint8_t i) const = 0;
+
+    int m_version;
+    long m_values[COUNT];
+};
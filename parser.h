@@ -1,15 +1,52 @@
-class Parser {
+#include "basicparser.h"
+#include "timeline.h"
+
+class Parser : public BasicParser {
   public:
     using MyAudioModule = BasicAudioModule;
-    explicit Parser(MyAudioModule &audio, Fogger *fogger = nullptr) :
-      m_audio(audio), m_fogger(fogger), m_p(nullptr) {}
+    typedef void (*Handler)();
+
+    // `show_stats`, if provided, is called for the "stats?" command,
+    // `enter_binary_mode` for the "binary" command, `timeline` starts the
+    // shows for "run", and `show_log` is called for "log?".
+    explicit Parser(
+      MyAudioModule &audio,
+      FogMachine *fogger = nullptr,
+      Handler show_stats = nullptr,
+      Handler enter_binary_mode = nullptr,
+      Timeline *timeline = nullptr,
+      Handler show_log = nullptr
+    ) :
+      m_audio(audio), m_fogger(fogger), m_show_stats(show_stats),
+      m_enter_binary_mode(enter_binary_mode), m_timeline(timeline),
+      m_show_log(show_log) {}
 
+    // A line can hold several commands separated by semicolons, e.g.,
+    // "volume=20; play 3".  They're executed in order.  Returns false if
+    // any of them wasn't recognized, but the rest are still executed.
     bool parse(const char *buf) {
       m_p = buf;
+      bool ok = true;
+      for (;;) {
+        SkipWhitespace();
+        if (*m_p != '\0' && *m_p != ';') {
+          if (!parseCommand()) ok = false;
+          while (*m_p != '\0' && *m_p != ';') Advance();
+        }
+        if (!Accept(';')) return ok;
+      }
+    }
+
+  private:
+    bool parseCommand() {
       switch (parseKeyword()) {
         case KW_BASS:
           m_audio.selectEQ(MyAudioModule::EQ_BASS);
           return true;
+        case KW_BINARY:
+          if (!m_enter_binary_mode) return false;
+          m_enter_binary_mode();
+          return true;
         case KW_CLASSICAL:
           m_audio.selectEQ(MyAudioModule::EQ_CLASSICAL);
           return true;
@@ -48,6 +85,11 @@ class Parser {
         case KW_JAZZ:
           m_audio.selectEQ(MyAudioModule::EQ_JAZZ);
           return true;
+        case KW_LOG:
+          Accept('?');
+          if (!m_show_log) return false;
+          m_show_log();
+          return true;
         case KW_NEXT:
           m_audio.playNextFile();
           return true;
@@ -91,6 +133,13 @@ class Parser {
         case KW_ROCK:
           m_audio.selectEQ(MyAudioModule::EQ_ROCK);
           return true;
+        case KW_RUN:
+          if (!m_timeline) return false;
+          if (parseKeyword() == KW_STOP) {
+            m_timeline->stop();
+            return true;
+          }
+          return m_timeline->run(parseUnsigned());
         case KW_SDCARD: return parseDeviceQuery(MyAudioModule::DEV_SDCARD);
         case KW_SELECT:
           switch(parseKeyword()) {
@@ -111,6 +160,11 @@ class Parser {
           Accept('?');
           m_audio.queryPlaybackSequence();
           return true;
+        case KW_STATS:
+          Accept('?');
+          if (!m_show_stats) return false;
+          m_show_stats();
+          return true;
         case KW_STATUS:
           Accept('?');
           m_audio.queryStatus();
@@ -137,7 +191,6 @@ class Parser {
       return false;
     }
 
-  private:
     bool parseDeviceQuery(typename MyAudioModule::Device device) {
       switch (parseKeyword()) {
         case KW_FILE:
@@ -159,120 +212,61 @@ class Parser {
       return false;
     }
 
-    enum Keyword {
-      KW_UNKNOWN, KW_BASS, KW_CLASSICAL, KW_COUNT, KW_EQ, KW_FILE, KW_FLASH,
-      KW_FOG, KW_FOLDER, KW_JAZZ, KW_LOOP, KW_NEXT, KW_NORMAL, KW_PAUSE,
-      KW_PLAY, KW_POP, KW_PREVIOUS, KW_RANDOM, KW_RESET, KW_ROCK, KW_SDCARD,
-      KW_SELECT, KW_SEQ, KW_STATUS, KW_STOP, KW_UNPAUSE, KW_USB, KW_VOLUME
+    enum Keyword : uint8_t {
+      KW_UNKNOWN, KW_BASS, KW_BINARY, KW_CLASSICAL, KW_COUNT, KW_EQ, KW_FILE,
+      KW_FLASH, KW_FOG, KW_FOLDER, KW_JAZZ, KW_LOG, KW_LOOP, KW_NEXT, KW_NORMAL,
+      KW_PAUSE, KW_PLAY, KW_POP, KW_PREVIOUS, KW_RANDOM, KW_RESET, KW_ROCK,
+      KW_RUN, KW_SDCARD, KW_SELECT, KW_SEQ, KW_STATS, KW_STATUS, KW_STOP,
+      KW_UNPAUSE, KW_USB, KW_VOLUME
     };
 
-    Keyword parseKeyword() {
-      while (Accept(' ') || Accept('\t')) {}
-      // A hand-rolled TRIE.  This may seem crazy, but many
-      // microcontrollers have very limited RAM.  A data-driven
-      // solution would require a table in RAM, so that's a
-      // non-starter.  Instead, we "unroll" what the data-driven
-      // solution would do so that it gets coded directly into
-      // program memory.  Believe it or not, the variadic template
-      // for AllowSuffix actually reduces the amount of code
-      // generated versus a completely hand-rolled expression.
-      if (Accept('b')) return AllowSuffix(KW_BASS, 'a', 's', 's');
-      if (Accept('c')) {
-        if (Accept('l')) return AllowSuffix(KW_CLASSICAL, 'a', 's', 's', 'i', 'c', 'a', 'l');
-        if (Accept('o')) return AllowSuffix(KW_COUNT, 'u', 'n', 't');
-        return KW_UNKNOWN;
-      }
-      if (Accept('e')) return AllowSuffix(KW_EQ, 'q');
-      if (Accept('f')) {
-        if (Accept('i')) return AllowSuffix(KW_FILE, 'l', 'e');
-        if (Accept('l')) return AllowSuffix(KW_FLASH, 'a', 's', 'h');
-        if (Accept('o')) {
-          if (Accept('g')) return KW_FOG;
-          if (Accept('l')) return AllowSuffix(KW_FOLDER, 'd', 'e', 'r');
-          return KW_UNKNOWN;
-        }
-        return KW_UNKNOWN;
-      }
-      if (Accept('j')) return AllowSuffix(KW_JAZZ, 'a', 'z', 'z');
-      if (Accept('l')) return AllowSuffix(KW_LOOP, 'o', 'o', 'p');
-      if (Accept('n')) {
-        if (Accept('e')) return AllowSuffix(KW_NEXT, 'x', 't');
-        if (Accept('o')) return AllowSuffix(KW_NORMAL, 'r', 'm', 'a', 'l');
-        return KW_UNKNOWN;
-      }
-      if (Accept('p')) {
-        if (Accept('a')) return AllowSuffix(KW_PAUSE, 'u', 's', 'e');
-        if (Accept('l')) return AllowSuffix(KW_PLAY, 'a', 'y');
-        if (Accept('o')) return AllowSuffix(KW_POP, 'p');
-        if (Accept('r')) return AllowSuffix(KW_PREVIOUS, 'e', 'v', 'i', 'o', 'u', 's');
-        return KW_UNKNOWN;
-      }
-      if (Accept('r')) {
-        if (Accept('a')) return AllowSuffix(KW_RANDOM, 'n', 'd', 'o', 'm');
-        if (Accept('e')) return AllowSuffix(KW_RESET, 's', 'e', 't');
-        if (Accept('o')) return AllowSuffix(KW_ROCK, 'c', 'k');
-        return KW_UNKNOWN;
-      }
-      if (Accept('s')) {
-        if (Accept('d')) return AllowSuffix(KW_SDCARD, 'c', 'a', 'r', 'd');
-        if (Accept('e')) {
-          if (Accept('q')) return AllowSuffix(KW_SEQ);
-          if (Accept('l')) return AllowSuffix(KW_SELECT, 'e', 'c', 't');
-          return KW_UNKNOWN;
-        }
-        if (Accept('t')) {
-          if (Accept('a')) return AllowSuffix(KW_STATUS, 't', 'u', 's');
-          if (Accept('o')) return AllowSuffix(KW_STOP, 'p');
-          return KW_UNKNOWN;
-        }
-        return KW_UNKNOWN;
-      }
-      if (Accept('u')) {
-        if (Accept('n')) return AllowSuffix(KW_UNPAUSE, 'p', 'a', 'u', 's', 'e');
-        if (Accept('s')) return AllowSuffix(KW_USB, 'b');
-        return KW_UNKNOWN;
-      }
-      if (Accept('v')) return AllowSuffix(KW_VOLUME, 'o', 'l', 'u', 'm', 'e');
-      return KW_UNKNOWN;
-    }
+    // The spellings live in a table in program memory.  See keywords.h.
+    static constexpr uint8_t KEYWORD_COUNT = 31;
+    static const KeywordEntry<Keyword, 10> s_keywords[KEYWORD_COUNT];
 
-    int parseInteger() {
-      while (Accept(' ')) {}
-      const bool neg = Accept('-');
-      if (!neg) Accept('+');
-      const auto result = static_cast<int>(parseUnsigned());
-      return neg ? -result : result;
-    }
-
-    unsigned parseUnsigned() {
-      while (Accept(' ')) {}
-      unsigned result = 0;
-      while (MatchDigit()) {
-        result *= 10;
-        result += *m_p - '0';
-        Advance();
-      }
-      return result;
-    }
-
-    bool Advance() { ++m_p; return true; }
-    bool Accept(char ch) { return (*m_p == ch) ? Advance() : false; }
-    bool MatchDigit() const { return '0' <= *m_p && *m_p <= '9'; }
-    bool MatchLetter() const { return 'a' <= *m_p && *m_p <= 'z'; }
-
-    bool AllowSuffix() { return !MatchLetter(); }
-
-    template <typename ... T>
-    bool AllowSuffix(char head, T... tail) {
-      return !MatchLetter() || (Accept(head) && AllowSuffix(tail...));
-    }
-
-    template <typename ... T>
-    Keyword AllowSuffix(Keyword kw, T... suffix) {
-      return AllowSuffix(suffix...) ? kw : KW_UNKNOWN;
+    Keyword parseKeyword() {
+      return parseKeywordFrom(s_keywords, KW_UNKNOWN, KeywordCase::FOLD);
     }
 
     MyAudioModule &m_audio;
-    Fogger *m_fogger;
-    const char *m_p;
+    FogMachine *m_fogger;
+    Handler m_show_stats;
+    Handler m_enter_binary_mode;
+    Timeline *m_timeline;
+    Handler m_show_log;
+};
+
+// Sorted by spelling.
+const KeywordEntry<Parser::Keyword, 10> Parser::s_keywords[] PROGMEM = {
+  {KW_BASS,      "bass"},
+  {KW_BINARY,    "binary"},
+  {KW_CLASSICAL, "classical"},
+  {KW_COUNT,     "count"},
+  {KW_EQ,        "eq"},
+  {KW_FILE,      "file"},
+  {KW_FLASH,     "flash"},
+  {KW_FOG,       "fog"},
+  {KW_FOLDER,    "folder"},
+  {KW_JAZZ,      "jazz"},
+  {KW_LOG,       "log"},
+  {KW_LOOP,      "loop"},
+  {KW_NEXT,      "next"},
+  {KW_NORMAL,    "normal"},
+  {KW_PAUSE,     "pause"},
+  {KW_PLAY,      "play"},
+  {KW_POP,       "pop"},
+  {KW_PREVIOUS,  "previous"},
+  {KW_RANDOM,    "random"},
+  {KW_RESET,     "reset"},
+  {KW_ROCK,      "rock"},
+  {KW_RUN,       "run"},
+  {KW_SDCARD,    "sdcard"},
+  {KW_SELECT,    "select"},
+  {KW_SEQ,       "seq"},
+  {KW_STATS,     "stats"},
+  {KW_STATUS,    "status"},
+  {KW_STOP,      "stop"},
+  {KW_UNPAUSE,   "unpause"},
+  {KW_USB,       "usb"},
+  {KW_VOLUME,    "volume"}
 };
@@ -1,48 +1,78 @@
-class PIR {
-  public:
-    PIR(int power, int signal, int ground) :
-      m_power(power), m_signal(signal), m_ground(ground),
-      m_motion_detected(false)
-    { }
+#include "../../eventlog.h"
+#include "../../motionarray.h"
+#include "../../scheduler.h"
 
-    void begin() {
-      pinMode(m_ground, OUTPUT);
-      digitalWrite(m_ground, LOW);
-      pinMode(m_signal, INPUT);
-      pinMode(m_power, OUTPUT);
-      digitalWrite(m_power, HIGH);
-    }
-
-    // Returns true if the state has changed since last update.
-    bool update() {
-      const auto signal = digitalRead(m_signal);
-      if (signal == HIGH && !m_motion_detected) {
-        m_motion_detected = true;
-        return true;
-      } else if (signal == LOW && m_motion_detected) {
-        m_motion_detected = false;
-        return true;
-      }
-      return false;  // no change
-    }
-
-    bool motion_detected() const { return m_motion_detected; }
-
-  private:
-    int m_power;
-    int m_signal;
-    int m_ground;
-    bool m_motion_detected;
+// Each sensor is powered from a pair of output pins, so it can plug right
+// into the headers.
+struct PIR {
+  uint8_t power;
+  uint8_t signal;
+  uint8_t ground;
 };
 
-PIR pir_sensors[] = { PIR(2, 3, 4) };
-char const * const names[] = { "Orange" };
+PIR const pir_sensors[] = {
+  {2, 3, 4}  // sensor 0, orange
+};
 int const led_pins[] = {8, 9};
 
 auto constexpr sensor_count = sizeof(pir_sensors) / sizeof(pir_sensors[0]);
 
+uint8_t signal_pins[sensor_count];
+auto motion = make_MotionArray(PinInputs(signal_pins, sensor_count));
+Scheduler<2> scheduler;
+
+// Each edge goes in the event log, which prints it when the serial port
+// has room, so a burst of edges doesn't hold up the sensor polling.
+enum : uint8_t { EV_MOTION, EV_NO_MOTION, EV_AGREE };
+char const MSG_MOTION[]    PROGMEM = "Sensor %: motion";
+char const MSG_NO_MOTION[] PROGMEM = "Sensor %: no motion";
+char const MSG_AGREE[]     PROGMEM = "All agree: motion";
+char const * const messages[] PROGMEM = { MSG_MOTION, MSG_NO_MOTION, MSG_AGREE };
+EventLog<16> event_log(messages);
+
+static void logEvent(MotionEvent const &event) {
+  switch (event.kind) {
+    case MotionEvent::STARTED:
+      event_log.recordAt(event.time, EV_MOTION, event.index);
+      break;
+    case MotionEvent::STOPPED:
+      event_log.recordAt(event.time, EV_NO_MOTION, event.index);
+      break;
+    case MotionEvent::RULE:
+      event_log.recordAt(event.time, EV_AGREE);
+      break;
+  }
+}
+
+static bool pollSensors() {
+  motion.update();
+  MotionEvent event;
+  while (motion.read(event)) logEvent(event);
+  for (unsigned i = 0; i < sensor_count; ++i) {
+    digitalWrite(led_pins[i], motion.motion(i) ? HIGH : LOW);
+  }
+  return false;
+}
+
+static bool pollLog() {
+  // Keep going while the serial port has room.
+  return event_log.update();
+}
+
 void setup() {
-  for (auto &sensor : pir_sensors) sensor.begin();
+  for (unsigned i = 0; i < sensor_count; ++i) {
+    auto const &sensor = pir_sensors[i];
+    pinMode(sensor.ground, OUTPUT);
+    digitalWrite(sensor.ground, LOW);
+    pinMode(sensor.power, OUTPUT);
+    digitalWrite(sensor.power, HIGH);
+    signal_pins[i] = sensor.signal;
+  }
+  motion.begin();
+  // With more than one sensor, report when they all see motion within
+  // 200 ms of each other.
+  if (sensor_count > 1) motion.addRule((1 << sensor_count) - 1, sensor_count, 200);
+
   for (auto &led_pin : led_pins) {
     pinMode(led_pin, OUTPUT);
     digitalWrite(led_pin, LOW);
@@ -50,22 +80,11 @@ void setup() {
 
   Serial.begin(115200);
   Serial.println(F("Hello PIR!"));
+
+  scheduler.add(pollSensors, 5000, F("sensors"));
+  scheduler.add(pollLog,    20000, F("log"));
 }
 
 void loop() {
-  for (unsigned i = 0; i < sensor_count; ++i) {
-    auto &sensor = pir_sensors[i];
-    auto &led_pin = led_pins[i];
-    if (sensor.update()) {
-      Serial.print(millis());
-      Serial.print(' ');
-      Serial.print(names[i]);
-      if (sensor.motion_detected()) {
-        Serial.println(F(": motion"));
-      } else {
-        Serial.println(F(": no motion"));
-      }
-    }
-    digitalWrite(led_pin, sensor.motion_detected() ? HIGH : LOW);
-  }
+  scheduler.run();
 }
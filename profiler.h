@@ -0,0 +1,73 @@
+// Lightweight timing statistics
+
+// Keeps the minimum, maximum, and a running average of a duration, such
+// as how long a device's `update` takes or how long it's been since the
+// previous pass through `loop`.  The average is an exponential moving
+// average, so it can run all night without the sums overflowing, and it
+// costs a shift and an add per sample.
+
+#pragma once
+
+#include "timeout.h"
+
+class TimingStats {
+  public:
+    TimingStats() { reset(); }
+
+    void reset() {
+      m_min = 0xFFFF;
+      m_max = 0;
+      m_avg16 = 0;
+      m_samples = 0;
+    }
+
+    // Durations are in microseconds and saturate at 65535.
+    void record(unsigned long duration) {
+      const uint16_t d = (duration > 0xFFFF) ? 0xFFFF : duration;
+      if (d < m_min) m_min = d;
+      if (d > m_max) m_max = d;
+      if (m_samples == 0) {
+        m_avg16 = static_cast<uint32_t>(d) << 4;
+      } else {
+        // Each sample contributes 1/16th to the average.
+        m_avg16 -= m_avg16 >> 4;
+        m_avg16 += d;
+      }
+      if (m_samples < 0xFFFF) ++m_samples;
+    }
+
+    uint16_t minimum() const { return m_samples ? m_min : 0; }
+    uint16_t maximum() const { return m_max; }
+    uint16_t average() const { return m_avg16 >> 4; }
+    bool empty() const { return m_samples == 0; }
+
+    // Prints "min/avg/max us".
+    void print(Print &out) const {
+      out.print(minimum());
+      out.print('/');
+      out.print(average());
+      out.print('/');
+      out.print(maximum());
+      out.print(F(" us"));
+    }
+
+  private:
+    uint16_t m_min;
+    uint16_t m_max;
+    uint32_t m_avg16;    // the average, times 16
+    uint16_t m_samples;  // saturates; we only care whether it's zero
+};
+
+// Measures the time from construction to destruction.
+//
+//     { ScopedTiming t(stats); device.update(); }
+class ScopedTiming {
+  public:
+    explicit ScopedTiming(TimingStats &stats) :
+      m_stats(stats), m_start(MicrosClock::now()) {}
+    ~ScopedTiming() { m_stats.record(MicrosClock::now() - m_start); }
+
+  private:
+    TimingStats &m_stats;
+    decltype(MicrosClock::now()) m_start;
+};
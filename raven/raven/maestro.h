@@ -0,0 +1,194 @@
+// Driver for a Pololu Maestro servo controller on a serial port
+
+// The sketch sets targets with `setTarget`, which only records them, and
+// calls `sendFrame` once per frame to send all of them in a single write.
+// The whole frame fits in the UART's transmit buffer, so sending never
+// stalls the loop.
+//
+// With MULTIPLE_TARGETS, a frame is one Set Multiple Targets command for
+// the contiguous block of channels starting at FIRST_CHANNEL.  Only the
+// Mini Maestro 12, 18, and 24 implement that command, so the (default)
+// SET_TARGET protocol instead packs one compact Set Target command per
+// channel into the frame, which every Maestro understands, including the
+// Micro.
+//
+// Either way, targets are in Mini SSC units, 0 to 254, in Q8.8 fixed
+// point (see servomotion.h), so the filtered motion keeps its fractional
+// steps.  Both commands take quarter-microseconds, which are finer still,
+// so we map the targets onto each channel's range around its neutral
+// position ourselves.  `begin` must be given the same neutral and range
+// that the channels are set to in the Maestro Control Center.
+//
+// `update` checks for errors in the background.  Every so often, it sends
+// a Get Errors request and then picks up the reply on later calls instead
+// of waiting for it.  If no reply arrives in time, the request is counted
+// as a timeout, and whatever arrived is discarded so the next reply
+// starts in sync.
+
+#pragma once
+
+#include "../../timeout.h"
+
+template <uint8_t FIRST_CHANNEL, uint8_t CHANNEL_COUNT>
+class Maestro {
+  public:
+    enum class Protocol : uint8_t { SET_TARGET, MULTIPLE_TARGETS };
+
+    enum Error : uint16_t {
+      ERR_SERIAL_SIGNAL   = 0x0001,
+      ERR_SERIAL_OVERRUN  = 0x0002,
+      ERR_BUFFER_FULL     = 0x0004,
+      ERR_CRC             = 0x0008,
+      ERR_PROTOCOL        = 0x0010,
+      ERR_TIMEOUT         = 0x0020,
+      ERR_SCRIPT_STACK    = 0x0040,
+      ERR_CALL_STACK      = 0x0080,
+      ERR_PROGRAM_COUNTER = 0x0100
+    };
+
+    static constexpr uint8_t NEUTRAL_POSITION = 127;
+
+    Maestro(Stream &stream, int reset_pin, Protocol protocol = Protocol::SET_TARGET) :
+      m_stream(stream),
+      m_reset_pin(reset_pin),
+      m_protocol(protocol),
+      m_awaiting_reply(false),
+      m_errors(0),
+      m_timeouts(0) {
+      for (auto &target : m_targets) target = NEUTRAL_POSITION << 8;
+    }
+
+    // The stream must already be open.  This resets the Maestro, which
+    // takes a moment, so call it from `setup`.
+    void begin(unsigned neutral_us = 1500, unsigned range_us = 476) {
+      m_neutral_us = neutral_us;
+      m_range_us = range_us;
+      pinMode(m_reset_pin, OUTPUT);
+      digitalWrite(m_reset_pin, LOW);
+      delay(500);
+      digitalWrite(m_reset_pin, HIGH);
+      delay(1000);
+      m_stream.write(BAUD_DETECT);
+      m_next_poll.set(ERROR_POLL_MS);
+    }
+
+    // `position` is in Q8.8 Mini SSC units.
+    void setTarget(uint8_t channel, uint16_t position) {
+      if (channel < FIRST_CHANNEL || FIRST_CHANNEL + CHANNEL_COUNT <= channel) return;
+      m_targets[channel - FIRST_CHANNEL] = position > MAX_POSITION ? MAX_POSITION : position;
+    }
+
+    uint16_t getTarget(uint8_t channel) const {
+      return m_targets[channel - FIRST_CHANNEL];
+    }
+
+    void sendFrame() {
+      uint8_t frame[FRAME_SIZE];
+      uint8_t len = 0;
+      if (m_protocol == Protocol::MULTIPLE_TARGETS) {
+        frame[len++] = CMD_SET_MULTIPLE_TARGETS;
+        frame[len++] = CHANNEL_COUNT;
+        frame[len++] = FIRST_CHANNEL;
+        for (const auto position : m_targets) {
+          const uint16_t target = quarterMicroseconds(position);
+          frame[len++] = target & 0x7F;
+          frame[len++] = (target >> 7) & 0x7F;
+        }
+      } else {
+        for (uint8_t i = 0; i < CHANNEL_COUNT; ++i) {
+          const uint16_t target = quarterMicroseconds(m_targets[i]);
+          frame[len++] = CMD_SET_TARGET;
+          frame[len++] = FIRST_CHANNEL + i;
+          frame[len++] = target & 0x7F;
+          frame[len++] = (target >> 7) & 0x7F;
+        }
+      }
+      m_stream.write(frame, len);
+    }
+
+    // Call regularly.  Never waits for the Maestro.
+    void update() {
+      if (m_awaiting_reply) {
+        if (m_stream.available() >= 2) {
+          // Two full bytes, low byte first.
+          const uint8_t lo = m_stream.read();
+          const uint8_t hi = m_stream.read();
+          m_errors |= (static_cast<uint16_t>(hi) << 8) | lo;
+          m_awaiting_reply = false;
+        } else if (m_reply_timeout.expired()) {
+          while (m_stream.available()) m_stream.read();
+          ++m_timeouts;
+          m_awaiting_reply = false;
+        }
+        return;
+      }
+      if (!m_next_poll.expired()) return;
+      m_stream.write(CMD_GET_ERRORS);
+      m_awaiting_reply = true;
+      m_reply_timeout.set(REPLY_TIMEOUT_MS);
+      m_next_poll.set(ERROR_POLL_MS);
+    }
+
+    // Returns the errors reported since the last call (a combination of
+    // Error bits) and clears them.  Reading the errors from the Maestro
+    // also clears them there.
+    uint16_t takeErrors() {
+      const auto errors = m_errors;
+      m_errors = 0;
+      return errors;
+    }
+
+    // The number of error requests that went unanswered.
+    unsigned timeouts() const { return m_timeouts; }
+
+    static void printErrors(Print &out, uint16_t errors) {
+      if (errors & ERR_SERIAL_SIGNAL)   out.print(F("serial signal "));
+      if (errors & ERR_SERIAL_OVERRUN)  out.print(F("serial overrun "));
+      if (errors & ERR_BUFFER_FULL)     out.print(F("buffer full "));
+      if (errors & ERR_CRC)             out.print(F("CRC error "));
+      if (errors & ERR_PROTOCOL)        out.print(F("protocol error "));
+      if (errors & ERR_TIMEOUT)         out.print(F("timeout "));
+      if (errors & ERR_SCRIPT_STACK)    out.print(F("script stack error "));
+      if (errors & ERR_CALL_STACK)      out.print(F("call stack error "));
+      if (errors & ERR_PROGRAM_COUNTER) out.print(F("program counter error "));
+    }
+
+  private:
+    static_assert(CHANNEL_COUNT > 0, "a Maestro needs at least one channel");
+    static_assert(FIRST_CHANNEL + CHANNEL_COUNT <= 24, "the biggest Maestro has 24 channels");
+
+    static constexpr uint8_t BAUD_DETECT              = 0xAA;
+    static constexpr uint8_t CMD_SET_TARGET           = 0x84;
+    static constexpr uint8_t CMD_SET_MULTIPLE_TARGETS = 0x9F;
+    static constexpr uint8_t CMD_GET_ERRORS           = 0xA1;
+
+    static constexpr uint8_t FRAME_SIZE =
+      4*CHANNEL_COUNT > 3 + 2*CHANNEL_COUNT ? 4*CHANNEL_COUNT : 3 + 2*CHANNEL_COUNT;
+
+    static constexpr uint16_t MAX_POSITION = 254u << 8;
+
+    // At 115200 baud, the two byte reply takes a fraction of a
+    // millisecond, so a late reply means something's wrong.
+    static constexpr unsigned ERROR_POLL_MS    = 250;
+    static constexpr unsigned REPLY_TIMEOUT_MS = 20;
+
+    // Mini SSC positions span neutral +/- range.  `position` is in Q8.8,
+    // and the fraction carries through to the quarter-microseconds.
+    uint16_t quarterMicroseconds(uint16_t position) const {
+      constexpr long neutral = static_cast<long>(NEUTRAL_POSITION) << 8;
+      const long offset = (static_cast<long>(position) - neutral) * (4l * m_range_us) / neutral;
+      return 4l * m_neutral_us + offset;
+    }
+
+    Stream &m_stream;
+    int m_reset_pin;
+    Protocol m_protocol;
+    unsigned m_neutral_us = 1500;
+    unsigned m_range_us = 476;
+    uint16_t m_targets[CHANNEL_COUNT];  // Q8.8
+    bool m_awaiting_reply;
+    uint16_t m_errors;
+    unsigned m_timeouts;
+    Timeout<MillisClock> m_next_poll;
+    Timeout<MillisClock> m_reply_timeout;
+};
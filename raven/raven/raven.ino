@@ -1,3 +1,8 @@
+#include "../../scheduler.h"
+#include "../../shownet.h"
+#include "maestro.h"
+#include "servomotion.h"
+
 template <typename Element, size_t Count>
 constexpr size_t arraySize(const Element (&)[Count]) noexcept {
   return Count;
@@ -5,83 +10,136 @@ constexpr size_t arraySize(const Element (&)[Count]) noexcept {
 
 auto constexpr maestro_reset_pin = 12;
 
+// Ground this pin to replay the recorded performance instead of following
+// the controller's pots.
+auto constexpr playback_pin = 7;
+
+auto constexpr frame_ms = 20;
+
 struct ServoConfig {
   uint8_t pot_pin;
   uint8_t servo_number;
   int in0;
   int in1;
-  int out0;
-  int out1;
+  uint8_t out0;
+  uint8_t out1;
+  uint16_t time_constant_ms;
+  uint16_t max_speed;  // units per second
+  uint16_t max_accel;  // units per second per second
 };
 
+// A 60 ms time constant at 50 frames per second matches the response of
+// the original `(3*pos + target) / 4` smoothing.
 static const ServoConfig servos[] = {
-  /* turn  */ { A0, 2, 1023, 0, 0, 254},
-  /* nod   */ { A1, 3, 1023, 0, 0, 254},
-  /* tilt  */ { A2, 5, 0, 1023, 0, 254},
-  /* wings */ { A3, 4, 0, 1023, 0, 254}
+  /* turn  */ { A0, 2, 1023, 0, 0, 254, 60,  400, 3000},
+  /* nod   */ { A1, 3, 1023, 0, 0, 254, 60,  600, 5000},
+  /* tilt  */ { A2, 5, 0, 1023, 0, 254, 60,  400, 3000},
+  /* wings */ { A3, 4, 0, 1023, 0, 254, 40, 1200, 12000}
+};
+
+auto constexpr servo_count = arraySize(servos);
+
+static LinearMap inputs[servo_count];
+static ServoFilter filters[servo_count];
+
+// A recorded performance, one column per servo in the order above.  Each
+// keyframe gives the number of frames (at 20 ms) to reach it.
+static const Keyframe<servo_count> performance[] PROGMEM = {
+  // frames  turn  nod  tilt  wings
+  {  50, {  127, 127,  127,   20 } },  // rest
+  {  40, {  200, 127,  110,   20 } },  // look left
+  {  15, {  200,  60,  110,   20 } },  // peck
+  {  15, {  200, 127,  110,   20 } },
+  {  60, {   50, 127,  150,   20 } },  // look right
+  {  10, {   50, 127,  150,  230 } },  // flap
+  {  10, {   50, 127,  150,   20 } },
+  {  10, {   50, 127,  150,  230 } },
+  {  10, {   50, 127,  150,   20 } },
+  {  40, {  127, 160,  127,   20 } },  // stare at the guests
+  { 100, {  127, 160,  127,   20 } }   // hold
 };
 
-// The Maestro Micro has 6 channels.  We'll have positions for all of them
-// even though the raven uses only 5 servos.
-static int positions[6] = { 127, 127, 127, 127, 127, 127 };
+static MotionPlayer<servo_count> player;
+
+// The raven plays its performance once when the show network (on
+// Serial1, through an RS-485 receiver) runs this show.
+auto constexpr network_show = 1;
+static bool cued = false;
 
-static void resetMaestro() {
-  Serial.println("Resetting the Maestro");
-  digitalWrite(maestro_reset_pin, LOW);
-  delay(500);
-  digitalWrite(maestro_reset_pin, HIGH);
-  delay(1000);
+static void runShow(uint8_t show) {
+  if (show != network_show) return;
+  player.start(performance, /* repeat */ false);
+  cued = true;
 }
 
-static void checkMaestroErrors() {
-  Serial2.print("\xAA\x0C\x21");
-  while (!Serial2.available()) {}
-  uint8_t const lo = Serial2.read();
-  while (!Serial2.available()) {}
-  uint8_t const hi = Serial2.read();
-  uint16_t const error_code = (static_cast<uint16_t>(hi) << 7) | lo;
-  if (error_code != 0) {
-    Serial.print("Errors: ");
-    if (error_code & 0x01) Serial.print("serial signal ");
-    if (error_code & 0x02) Serial.print("serial overrun ");
-    if (error_code & 0x04) Serial.print("buffer full ");
-    if (error_code & 0x08) Serial.print("CRC error ");
-    if (error_code & 0x10) Serial.print("protocol error ");
-    if (error_code & 0x20) Serial.print("timeout ");
-    if (error_code & 0x40) Serial.print("script stack error ");
-    if (error_code & 0x80) Serial.print("call stack error ");
-    if (error_code & 0x100) Serial.print("program counter error ");
-    Serial.println();
+static void stopShow() {
+  cued = false;
+  player.stop();
+}
+
+static ShowNode network(Serial1, runShow, stopShow);
+
+// The raven's servos are on channels 2 through 5 of a Maestro Micro,
+// which doesn't have the Set Multiple Targets command.
+static auto maestro = Maestro<2, 4>(Serial2, maestro_reset_pin);
+static Scheduler<3> scheduler;
+
+// Every frame, move all the servos toward the controller's pots or the
+// recorded performance.
+static bool updateFrame() {
+  const bool held = digitalRead(playback_pin) == LOW;
+  if (held && !player.playing()) player.start(performance);
+  if (!held && !cued) player.stop();
+  if (!player.tick()) cued = false;
+  const bool playback = held || cued;
+
+  for (uint8_t i = 0; i < servo_count; ++i) {
+    auto const &servo = servos[i];
+    auto const target = playback ? player.target(i) : inputs[i](analogRead(servo.pot_pin));
+    auto const position = filters[i].update(target);
+    maestro.setTarget(servo.servo_number, position);
   }
+  maestro.sendFrame();
+  return false;
 }
 
-static void setServo(uint8_t number, uint8_t position) {
-  uint8_t buffer[3] = {static_cast<uint8_t>('\xFF'), number, position};
-  Serial2.write(buffer, 3);
-  checkMaestroErrors();
+static bool pollNetwork() {
+  network.update();
+  return false;
 }
 
-static void updateServo(ServoConfig const &servo, int &pos) {
-  auto const value = analogRead(servo.pot_pin);
-  auto const target = map(value, servo.in0, servo.in1, servo.out0, servo.out1);
-  pos = constrain((3*pos + target) / 4, 0, 254);
-  setServo(servo.servo_number, static_cast<uint8_t>(pos));
+static bool pollMaestro() {
+  maestro.update();
+  if (auto const errors = maestro.takeErrors()) {
+    Serial.print(F("Errors: "));
+    maestro.printErrors(Serial, errors);
+    Serial.println();
+  }
+  return false;
 }
 
 void setup() {
   Serial.begin(115200);
   Serial.println("\nHello, Raven!\n");
 
-  pinMode(maestro_reset_pin, OUTPUT);
-  resetMaestro();
+  pinMode(playback_pin, INPUT_PULLUP);
+  for (uint8_t i = 0; i < servo_count; ++i) {
+    auto const &servo = servos[i];
+    inputs[i].configure(servo.in0, servo.in1, servo.out0, servo.out1);
+    filters[i].configure(frame_ms, servo.time_constant_ms, servo.max_speed, servo.max_accel);
+  }
+
+  Serial1.begin(9600);
   Serial2.begin(115200);
   while (!Serial2) delay(10);
-  Serial2.print('\xAA');  // causes Maestro to detect the baud rate
+  Serial.println(F("Resetting the Maestro"));
+  maestro.begin();
+
+  scheduler.add(updateFrame, frame_ms * 1000ul, F("frame"));
+  scheduler.add(pollMaestro, 1000, F("maestro"));
+  scheduler.add(pollNetwork, 1000, F("network"));
 }
 
 void loop() {
-  for (auto const &servo : servos) {
-    updateServo(servo, positions[servo.servo_number]);
-  }
-  delay(20);
+  scheduler.run();
 }
@@ -0,0 +1,195 @@
+// Fixed-point servo motion: input mapping, smoothing, and playback
+
+// Positions are in Mini SSC units (0 to 254, see maestro.h) in Q8.8 fixed
+// point, that is, with the unit in the high byte and 1/256ths in the low
+// byte.  The fraction lets a slow movement advance a little every frame
+// instead of stalling until it has built up a whole unit.
+//
+// Everything that takes a division (slopes, filter gains, and limits) is
+// worked out once by `configure`, so the per-frame math is multiplies,
+// shifts, and adds.
+
+#pragma once
+
+typedef uint16_t PositionQ8;  // 0 to 254 in Q8.8
+typedef int16_t VelocityQ8;   // units per frame in Q8.8
+
+constexpr PositionQ8 MAX_POSITION = 254u << 8;
+
+inline PositionQ8 toPositionQ8(uint8_t position) {
+  return static_cast<PositionQ8>(position) << 8;
+}
+
+// Rounds to the nearest whole unit.
+inline uint8_t fromPositionQ8(PositionQ8 position) {
+  return (position + 0x80) >> 8;
+}
+
+// Maps an analog reading onto a position like `map`, but with a slope
+// computed ahead of time.
+class LinearMap {
+  public:
+    void configure(int in0, int in1, uint8_t out0, uint8_t out1) {
+      m_in0 = in0;
+      m_out0 = toPositionQ8(out0);
+      // Q16.16 output units per input unit.
+      m_slope = (static_cast<long>(out1 - out0) << 16) / (in1 - in0);
+    }
+
+    PositionQ8 operator()(int value) const {
+      const long position = m_out0 + ((static_cast<long>(value - m_in0) * m_slope) >> 8);
+      return constrain(position, 0L, static_cast<long>(MAX_POSITION));
+    }
+
+  private:
+    int m_in0 = 0;
+    PositionQ8 m_out0 = 0;
+    long m_slope = 0;
+};
+
+// Moves a position toward its target like a first-order low-pass filter
+// with the given time constant, optionally capped by a top speed and an
+// acceleration limit.  The gain is derived from the frame period, so the
+// motion looks the same at any frame rate.
+class ServoFilter {
+  public:
+    // The speed is in units per second and the acceleration in units per
+    // second per second.  A time constant of 0 follows the target
+    // directly (subject to the limits), and a limit of 0 means none.
+    void configure(
+      uint16_t frame_ms,
+      uint16_t time_constant_ms,
+      uint16_t max_speed = 0,
+      uint16_t max_accel = 0
+    ) {
+      // alpha = frame / (tau + frame), in Q0.8 (256 means 1.0)
+      m_alpha = (256ul * frame_ms) / (time_constant_ms + frame_ms);
+      if (m_alpha == 0) m_alpha = 1;
+      // "Unlimited" still caps a frame's move at half of full scale, which
+      // keeps the velocity within 16 bits.
+      m_max_speed = max_speed == 0 ? 0x7FFF : perFrame(256ul * max_speed * frame_ms / 1000);
+      m_max_accel = perFrame(256ul * max_accel * frame_ms / 1000 * frame_ms / 1000);
+      if (max_accel != 0 && m_max_accel == 0) m_max_accel = 1;
+    }
+
+    // Jumps straight to `position`, at rest.
+    void reset(PositionQ8 position) {
+      m_position = position;
+      m_velocity = 0;
+    }
+
+    // Advances one frame toward `target`.
+    PositionQ8 update(PositionQ8 target) {
+      const long error = static_cast<long>(target) - m_position;
+      long velocity = (error * m_alpha) >> 8;
+      // Without this, the position would creep toward the target forever
+      // in ever-smaller fractions.
+      if (velocity == 0 && error != 0) velocity = error;
+      if (m_max_accel != 0) {
+        velocity = constrain(velocity, m_velocity - m_max_accel, m_velocity + m_max_accel);
+      }
+      velocity = constrain(velocity, -m_max_speed, m_max_speed);
+      const long position = static_cast<long>(m_position) + velocity;
+      m_position = constrain(position, 0L, static_cast<long>(MAX_POSITION));
+      m_velocity = velocity;
+      return m_position;
+    }
+
+    PositionQ8 position() const { return m_position; }
+
+  private:
+    static VelocityQ8 perFrame(unsigned long limit) {
+      return limit > 0x7FFF ? 0x7FFF : static_cast<VelocityQ8>(limit);
+    }
+
+    PositionQ8 m_position = 127u << 8;
+    VelocityQ8 m_velocity = 0;
+    uint16_t m_alpha = 256;
+    VelocityQ8 m_max_speed = 0x7FFF;
+    VelocityQ8 m_max_accel = 0;
+};
+
+// One step of a recorded performance: where each channel should be, and
+// how many frames it takes to get there from the previous keyframe.  When
+// a repeating curve wraps around, the first keyframe's count is used for
+// the move from the last one back to it.
+template <uint8_t CHANNELS>
+struct Keyframe {
+  uint8_t frames;
+  uint8_t positions[CHANNELS];
+};
+
+// Plays a table of keyframes from PROGMEM, interpolating linearly.  The
+// step size for each channel is worked out once per keyframe, so a frame
+// costs just an add per channel.
+//
+// Playback starts by jumping to the first keyframe, so run the targets
+// through a ServoFilter with speed limits to ease into it.
+template <uint8_t CHANNELS>
+class MotionPlayer {
+  public:
+    typedef Keyframe<CHANNELS> Frame;
+
+    template <size_t N>
+    void start(const Frame (&curve)[N], bool repeat = true) {
+      start(curve, N, repeat);
+    }
+
+    void start(const Frame *curve, uint8_t count, bool repeat = true) {
+      m_curve = curve;
+      m_count = count;
+      m_repeat = repeat;
+      m_index = 0;
+      for (uint8_t i = 0; i < CHANNELS; ++i) {
+        m_targets[i] = toPositionQ8(pgm_read_byte(&curve[0].positions[i]));
+      }
+      nextKeyframe();
+    }
+
+    void stop() { m_curve = nullptr; }
+    bool playing() const { return m_curve != nullptr; }
+
+    // Advances one frame.  Returns false when a non-repeating curve has
+    // finished, in which case the targets hold at the last keyframe.
+    bool tick() {
+      if (!playing()) return false;
+      if (m_remaining <= 1) {
+        // Land exactly on the keyframe so rounding doesn't accumulate.
+        for (uint8_t i = 0; i < CHANNELS; ++i) {
+          m_targets[i] = toPositionQ8(pgm_read_byte(&m_curve[m_index].positions[i]));
+        }
+        nextKeyframe();
+        return playing();
+      }
+      for (uint8_t i = 0; i < CHANNELS; ++i) m_targets[i] += m_steps[i];
+      --m_remaining;
+      return true;
+    }
+
+    PositionQ8 target(uint8_t channel) const { return m_targets[channel]; }
+
+  private:
+    void nextKeyframe() {
+      if (++m_index == m_count) {
+        if (!m_repeat) { stop(); return; }
+        m_index = 0;
+      }
+      const Frame &frame = m_curve[m_index];
+      const uint8_t frames = pgm_read_byte(&frame.frames);
+      m_remaining = frames;
+      for (uint8_t i = 0; i < CHANNELS; ++i) {
+        const long distance =
+          static_cast<long>(toPositionQ8(pgm_read_byte(&frame.positions[i]))) - m_targets[i];
+        // With fewer than two frames, `tick` goes straight to the keyframe.
+        m_steps[i] = frames < 2 ? 0 : distance / frames;
+      }
+    }
+
+    const Frame *m_curve = nullptr;
+    uint8_t m_count = 0;
+    uint8_t m_index = 0;
+    uint8_t m_remaining = 0;
+    bool m_repeat = true;
+    PositionQ8 m_targets[CHANNELS];
+    VelocityQ8 m_steps[CHANNELS];
+};
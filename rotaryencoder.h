@@ -1,17 +1,23 @@
 // Rotary Encoder
 // Adrian McCarthy 2021
 
+#include "fastpin.h"
+
+// The A and B pins can be plain pin numbers or `FastPin`s.
+template <typename APin = DigitalPin, typename BPin = DigitalPin>
 class RotaryEncoder {
   public:
-    RotaryEncoder(int A_pin, int B_pin, int button_pin = 0, int red_pin = 0, int green_pin = 0) :
+    RotaryEncoder(APin A_pin, BPin B_pin, int button_pin = 0, int red_pin = 0, int green_pin = 0) :
       m_a(A_pin), m_b(B_pin), m_button(button_pin), m_red(red_pin), m_green(green_pin),
-      m_counts_per_detent(1), m_state(0), m_raw_count(0) {}
+      m_counts_per_detent(1), m_interrupt_driven(false), m_state(0), m_raw_count(0),
+      m_missed(0), m_snapshot(0) {}
 
     void begin() {
-      pinMode(m_a, INPUT_PULLUP);
-      pinMode(m_b, INPUT_PULLUP);
+      m_a.inputPullup();
+      m_b.inputPullup();
       updateState();
       m_raw_count = 0;
+      m_snapshot = 0;
       if (m_button != 0) {
         pinMode(m_button, INPUT_PULLUP);
       }
@@ -25,35 +31,77 @@ class RotaryEncoder {
       }
     }
 
-    int count() const { return m_counts_per_detent * (m_raw_count + 2) / 4; }
-    void reset() { m_raw_count = 0; }
+#if defined(__AVR__)
+    // In interrupt-driven mode, the A and B pins are sampled by `sample`,
+    // which you call from an ISR, so no transitions are lost no matter how
+    // long `loop` takes.  `update` then just checks the latest count.
+    //
+    // Use `enablePinChangeInterrupts` to have the A and B pins trigger
+    // the pin-change interrupt.  You must still define the ISR yourself:
+    //
+    //     ISR(PCINT2_vect) { rotary_encoder.sample(); }
+    //
+    // Each vector covers a whole port, and a sketch can define it only
+    // once.  If something else owns the one for the encoder's pins (as
+    // SoftwareSerial owns all three), call `sample` from a periodic timer
+    // interrupt instead, and call `useInterrupts` to select the mode.
+    void enablePinChangeInterrupts() {
+      const int a = m_a.number();
+      const int b = m_b.number();
+      *digitalPinToPCMSK(a) |= bit(digitalPinToPCMSKbit(a));
+      *digitalPinToPCMSK(b) |= bit(digitalPinToPCMSKbit(b));
+      PCICR |= bit(digitalPinToPCICRbit(a)) | bit(digitalPinToPCICRbit(b));
+      useInterrupts();
+    }
+
+    void useInterrupts() { m_interrupt_driven = true; }
+
+    // ISR-safe.  With FastPins, this reads the pins directly from the
+    // port registers.
+    void sample() {
+      updateState();
+      m_raw_count += decode(m_state);
+      if (isMissed(m_state)) ++m_missed;
+    }
+#endif
+
+    int count() const { return m_counts_per_detent * (m_snapshot + 2) / 4; }
+
+    // The number of times both A and B changed between samples, which
+    // means we missed at least one transition.  A steadily climbing count
+    // means the encoder isn't being sampled often enough.
+    unsigned missedTransitions() const {
+#if defined(__AVR__)
+      const uint8_t sreg = SREG;
+      cli();
+      const unsigned missed = m_missed;
+      SREG = sreg;
+      return missed;
+#else
+      return m_missed;
+#endif
+    }
+
+    void reset() {
+#if defined(__AVR__)
+      const uint8_t sreg = SREG;
+      cli();
+      m_raw_count = 0;
+      SREG = sreg;
+#else
+      m_raw_count = 0;
+#endif
+      m_snapshot = 0;
+    }
 
     bool update() {
-      enum { CW=1, CCW=-1, INVALID=0, NO_CHANGE=0 };
-      // Decoder is indexed by four bits: old A, old B, new A, new B
-      static constexpr int table[16] = {
-        /* 0b0000 */ NO_CHANGE,
-        /* 0b0001 */ CCW,
-        /* 0b0010 */ CW,
-        /* 0b0011 */ INVALID,
-        /* 0b0100 */ CW,
-        /* 0b0101 */ NO_CHANGE,
-        /* 0b0110 */ INVALID,
-        /* 0b0111 */ CCW,
-        /* 0b1000 */ CCW,
-        /* 0b1001 */ INVALID,
-        /* 0b1010 */ NO_CHANGE,
-        /* 0b1011 */ CW,
-        /* 0b1100 */ INVALID,
-        /* 0b1101 */ CW,
-        /* 0b1110 */ CCW,
-        /* 0b1111 */ NO_CHANGE
-      };
+      if (m_interrupt_driven) return updateFromSnapshot();
       updateState();
-      const auto delta = table[m_state];
+      const auto delta = decode(m_state);
       m_raw_count += delta;
-      if (m_red   != 0) digitalWrite(m_red,   delta < 0 ? HIGH : LOW);
-      if (m_green != 0) digitalWrite(m_green, delta > 0 ? HIGH : LOW);
+      if (isMissed(m_state)) ++m_missed;
+      m_snapshot = m_raw_count;
+      showDirection(delta);
       if (delta == 0) return false;
       switch (m_counts_per_detent % 4) {
         case 0: return true;
@@ -63,16 +111,81 @@ class RotaryEncoder {
     }
 
     private:
+      static int8_t decode(uint8_t state) {
+        enum { CW=1, CCW=-1, INVALID=0, NO_CHANGE=0 };
+        // Decoder is indexed by four bits: old A, old B, new A, new B
+        static constexpr int8_t table[16] = {
+          /* 0b0000 */ NO_CHANGE,
+          /* 0b0001 */ CCW,
+          /* 0b0010 */ CW,
+          /* 0b0011 */ INVALID,
+          /* 0b0100 */ CW,
+          /* 0b0101 */ NO_CHANGE,
+          /* 0b0110 */ INVALID,
+          /* 0b0111 */ CCW,
+          /* 0b1000 */ CCW,
+          /* 0b1001 */ INVALID,
+          /* 0b1010 */ NO_CHANGE,
+          /* 0b1011 */ CW,
+          /* 0b1100 */ INVALID,
+          /* 0b1101 */ CW,
+          /* 0b1110 */ CCW,
+          /* 0b1111 */ NO_CHANGE
+        };
+        return table[state & 0x0F];
+      }
+
+      // Both bits changed, which is one of the INVALID table entries.
+      static bool isMissed(uint8_t state) {
+        return ((state ^ (state >> 2)) & 0b11) == 0b11;
+      }
+
+      bool updateFromSnapshot() {
+#if defined(__AVR__)
+        // The count is wider than a byte, so we must keep the ISR from
+        // changing it while we copy it.
+        const uint8_t sreg = SREG;
+        cli();
+        const int raw = m_raw_count;
+        SREG = sreg;
+#else
+        const int raw = m_raw_count;
+#endif
+        const int delta = raw - m_snapshot;
+        showDirection(delta);
+        if (delta == 0) return false;
+        const int old_count = count();
+        m_snapshot = raw;
+        return count() != old_count;
+      }
+
+      void showDirection(int delta) {
+        if (m_red   != 0) digitalWrite(m_red,   delta < 0 ? HIGH : LOW);
+        if (m_green != 0) digitalWrite(m_green, delta > 0 ? HIGH : LOW);
+      }
+
       void updateState() {
         m_state = (m_state << 2) & 0x0F;
-        m_state |= (digitalRead(m_a) == HIGH) ? 0b10 : 0;
-        m_state |= (digitalRead(m_b) == HIGH) ? 0b01 : 0;
+        m_state |= m_a.read() ? 0b10 : 0;
+        m_state |= m_b.read() ? 0b01 : 0;
       }
-      
-      int m_a, m_b;
+
+      APin m_a;
+      BPin m_b;
       int m_button;
       int m_red, m_green;
       uint8_t m_counts_per_detent;
-      uint8_t m_state;
-      int m_raw_count;
+      bool m_interrupt_driven;
+      // These are shared with the ISR in interrupt-driven mode.
+      volatile uint8_t m_state;
+      volatile int m_raw_count;
+      volatile unsigned m_missed;
+      int m_snapshot;  // the raw count as of the last `update`
 };
+
+template <typename APin, typename BPin>
+RotaryEncoder<APin, BPin> make_RotaryEncoder(
+  APin A_pin, BPin B_pin, int button_pin = 0, int red_pin = 0, int green_pin = 0
+) {
+  return RotaryEncoder<APin, BPin>(A_pin, B_pin, button_pin, red_pin, green_pin);
+}
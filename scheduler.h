@@ -0,0 +1,149 @@
+// Cooperative task scheduler
+
+// Instead of calling every device's `update` on every pass through `loop`,
+// each task runs at its own period.  When nothing is due, the processor
+// idles until the next interrupt.  In idle sleep the timers, UARTs, and
+// pin-change interrupts keep running, so no input is lost, and Timer0's
+// millis() interrupt ensures we wake at least once a millisecond.
+//
+// A task is a plain function.  It returns true if it has more work to do
+// and wants to run again right away (e.g., the MSGEQ7 in the middle of
+// a strobe sequence), or false to wait until its next period.
+//
+//     Scheduler<4> scheduler;
+//     bool pollTimers() { timers.update(); return false; }
+//     void setup() { scheduler.add(pollTimers, 1000); }
+//     void loop() { scheduler.run(); }
+//
+// The scheduler also keeps timing statistics: how long each task takes
+// and how long it's been between calls to `run`.  Use `printStats` to
+// see where the time goes.
+
+#pragma once
+
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#endif
+
+#include "profiler.h"
+#include "timeout.h"
+
+template <int MAX_TASKS, class Clock = MicrosClock>
+class Scheduler {
+  public:
+    typedef bool (*Task)();
+    typedef decltype(Clock::now()) TimeRep;
+    static_assert(sizeof(TimeRep) == sizeof(long), "expected an unsigned long clock");
+
+    Scheduler() : m_count(0), m_sleep(true), m_last_run(0) {}
+
+    // `period` is in the units of the Clock (microseconds by default) and
+    // must be less than half of the range of a TimeRep.  The name is used
+    // only by `printStats`.  Returns false if there's no room for another
+    // task.
+    bool add(Task task, TimeRep period, const __FlashStringHelper *name = nullptr) {
+      if (m_count == MAX_TASKS) return false;
+      auto &entry = m_tasks[m_count++];
+      entry.task = task;
+      entry.period = period;
+      entry.due = Clock::now();
+      entry.name = name;
+      return true;
+    }
+
+    // Battery-powered props benefit from sleeping, but you might want
+    // to turn it off while debugging timing.
+    void enableSleep(bool enable) { m_sleep = enable; }
+
+    // Call from `loop`.  Runs every task that's due, in the order they
+    // were added, and then sleeps if none of them asked to run again.
+    void run() {
+      const auto start = MicrosClock::now();
+      if (m_last_run != 0) m_loop_stats.record(start - m_last_run);
+      m_last_run = start;
+
+      bool busy = false;
+      for (uint8_t i = 0; i < m_count; ++i) {
+        auto &entry = m_tasks[i];
+        const auto now = Clock::now();
+        if (!reached(now, entry.due)) continue;
+        bool again;
+        {
+          ScopedTiming timing(entry.stats);
+          again = entry.task();
+        }
+        if (again) {
+          busy = true;
+        } else {
+          // Advancing from the previous deadline rather than from `now`
+          // keeps a task's average rate steady.  If we've fallen more than
+          // a whole period behind, we skip ahead rather than running the
+          // task several times in a row to catch up.
+          entry.due += entry.period;
+          if (reached(now, entry.due)) entry.due = now + entry.period;
+        }
+      }
+      if (!busy && m_sleep && !anyDue()) idle();
+    }
+
+    // Prints the period between calls to `run` (which includes any time
+    // spent sleeping) and the cost of each task.
+    void printStats(Print &out) const {
+      out.print(F("loop: "));
+      m_loop_stats.print(out);
+      out.println();
+      for (uint8_t i = 0; i < m_count; ++i) {
+        const auto &entry = m_tasks[i];
+        if (entry.name) {
+          out.print(entry.name);
+        } else {
+          out.print(F("task "));
+          out.print(i);
+        }
+        out.print(F(": "));
+        entry.stats.print(out);
+        out.println();
+      }
+    }
+
+    void resetStats() {
+      m_loop_stats.reset();
+      for (uint8_t i = 0; i < m_count; ++i) m_tasks[i].stats.reset();
+    }
+
+  private:
+    struct Entry {
+      Task task;
+      TimeRep period;
+      TimeRep due;
+      const __FlashStringHelper *name;
+      TimingStats stats;  // the cost of each call, in microseconds
+    };
+
+    // True if `now` is at or past `deadline`.  The signed difference
+    // keeps this correct across clock rollover.
+    static bool reached(TimeRep now, TimeRep deadline) {
+      return static_cast<long>(now - deadline) >= 0;
+    }
+
+    bool anyDue() const {
+      const auto now = Clock::now();
+      for (uint8_t i = 0; i < m_count; ++i) {
+        if (reached(now, m_tasks[i].due)) return true;
+      }
+      return false;
+    }
+
+    static void idle() {
+#if defined(__AVR__)
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+#endif
+    }
+
+    Entry m_tasks[MAX_TASKS];
+    uint8_t m_count;
+    bool m_sleep;
+    decltype(MicrosClock::now()) m_last_run;
+    TimingStats m_loop_stats;
+};
@@ -0,0 +1,253 @@
+// A show network: one master and any number of props on an RS-485 bus
+
+// When a scene spans several controllers, each with its own millis(), a
+// cue sent over a console link lands whenever it lands.  On a show
+// network, the master broadcasts two kinds of frames on a shared RS-485
+// bus, using the same framing as the audio modules (see framedmessage.h):
+//
+// * Sync beacons carry the master's show clock, a few times a second.
+//   Each node keeps ShowClock, which is millis() corrected by the offset
+//   from the latest beacon, so every prop agrees on the time to within a
+//   millisecond or two.
+// * Run cues name a show and the show-clock time it starts.  The master
+//   sends them a little ahead (the lead), and every node, the master
+//   included, starts the show when its ShowClock gets there, no matter
+//   how long its frame took to arrive or be noticed.
+//
+// Only the master transmits, so there are no collisions to manage.  A
+// node just listens with its transceiver's receiver enabled.  The master
+// raises the transceiver's driver-enable pin for each frame and drops it
+// once the frame's last bit is out, without waiting in `update`.
+//
+// Frames are 10 bytes, so at 9600 baud a frame takes about 10 ms on the
+// wire.  The master stamps each beacon with the time its last bit will go
+// out, so that's already accounted for when a node sets its clock.  A
+// lead of 50 ms covers a cue's airtime and the nodes' polling with room
+// to spare.
+//
+// Times in the frames are truncated (24 bits in a beacon, 16 bits in a
+// cue) and each node unwraps them around its own clock, so a cue must
+// start within about half a minute of being sent.  A node's clock can
+// differ from the master's by a multiple of 2^24 ms, which doesn't matter
+// since only differences in time are ever compared.
+
+#pragma once
+
+#include "fastpin.h"
+#include "framedmessage.h"
+#include "timeout.h"
+
+enum NetOpcode : uint8_t {
+  NET_SYNC = 0x70,  // extra: time bits 16-23, param: time bits 0-15
+  NET_RUN  = 0x71,  // extra: show number, param: start time bits 0-15
+  NET_STOP = 0x72
+};
+
+typedef FramedMessage<NetOpcode> NetMessage;
+
+// The show clock, in milliseconds.  It's millis() on the master and
+// millis() plus the latest correction on a node.  It works as a Clock for
+// Timeout.
+struct ShowClock {
+  static unsigned long now() { return millis() + offset(); }
+
+  static long &offset() {
+    static long value = 0;
+    return value;
+  }
+};
+
+namespace shownet {
+  // How long a whole frame takes on the wire, with a start and a stop
+  // bit per byte.
+  inline unsigned long frameMicros(unsigned long baud) {
+    return (10ul * 10 * 1000000 + baud - 1) / baud;
+  }
+
+  // Reconstructs the full time nearest `reference` that ends in `bits`,
+  // which is the low `width` bits of the time.
+  inline unsigned long unwrap(unsigned long reference, unsigned long bits, uint8_t width) {
+    const unsigned long mask = (1ul << width) - 1;
+    unsigned long delta = (bits - reference) & mask;
+    // Past halfway, it's nearer to go back.
+    if (delta & (1ul << (width - 1))) delta |= ~mask;
+    return reference + delta;
+  }
+}
+
+// The part common to the master and the nodes: a show waiting for its
+// start time.
+class ShowLink {
+  public:
+    typedef void (*RunHandler)(uint8_t show);
+    typedef void (*StopHandler)();
+
+    ShowLink(RunHandler run, StopHandler stop) : m_run(run), m_stop(stop) {}
+
+    // True while a show is waiting for its start time.
+    bool cued() const { return m_cued != 0; }
+
+  protected:
+    void cue(uint8_t show, unsigned long start) {
+      m_cued = show;
+      const auto delta = start - ShowClock::now();
+      // A start that's already past is due now.
+      m_start.set(static_cast<long>(delta) > 0 ? delta : 0);
+    }
+
+    void cancel() {
+      m_cued = 0;
+      m_start.cancel();
+      if (m_stop) m_stop();
+    }
+
+    void checkCue() {
+      if (m_cued == 0 || !m_start.expired()) return;
+      const uint8_t show = m_cued;
+      m_cued = 0;
+      m_start.cancel();
+      if (m_run) m_run(show);
+    }
+
+  private:
+    RunHandler m_run;
+    StopHandler m_stop;
+    uint8_t m_cued = 0;
+    Timeout<ShowClock> m_start;
+};
+
+template <typename EnablePin = DigitalPin>
+class ShowMaster : public ShowLink {
+  public:
+    // `run` and `stop` start and stop the master's own part of each show.
+    ShowMaster(
+      Stream &bus, EnablePin enable_pin, unsigned long baud,
+      RunHandler run = nullptr, StopHandler stop = nullptr
+    ) :
+      ShowLink(run, stop), m_bus(bus), m_enable_pin(enable_pin),
+      m_frame_us(shownet::frameMicros(baud)) {}
+
+    void begin() {
+      m_enable_pin.output();
+      m_enable_pin.low();
+      ShowClock::offset() = 0;
+      m_beacon.set(0);
+    }
+
+    // Starts show `show` everywhere, `lead_ms` from now.
+    void run(uint8_t show, uint16_t lead_ms = 50) {
+      const auto start = ShowClock::now() + lead_ms;
+      send(NET_RUN, show, start & 0xFFFF);
+      cue(show, start);
+    }
+
+    void stop() {
+      send(NET_STOP, 0, 0);
+      cancel();
+    }
+
+    // Call every millisecond or so.
+    void update() {
+      if (m_beacon.expired()) {
+        m_beacon.set(BEACON_MS);
+        // Stamped with when the beacon's last bit will be out, which is
+        // when the nodes will see it.
+        const auto done_at = ShowClock::now() + (queueMicros() + m_frame_us) / 1000;
+        send(NET_SYNC, (done_at >> 16) & 0xFF, done_at & 0xFFFF);
+      }
+      if (m_enabled && queueMicros() == 0) {
+        m_enable_pin.low();
+        m_enabled = false;
+      }
+      checkCue();
+    }
+
+  private:
+    static constexpr unsigned long BEACON_MS = 250;
+
+    // How long until the frames already sent are all on the wire.
+    unsigned long queueMicros() const {
+      if (!m_enabled) return 0;
+      const long remaining = m_idle_at - MicrosClock::now();
+      return remaining > 0 ? remaining : 0;
+    }
+
+    void send(NetOpcode opcode, uint8_t extra, uint16_t param) {
+      NetMessage msg;
+      msg.setExtended(opcode, extra, param);
+      // The new frame goes out after whatever is still queued, and the
+      // driver stays enabled one more bit time, for good measure.
+      m_idle_at = MicrosClock::now() + queueMicros() + m_frame_us + m_frame_us / 100;
+      m_enable_pin.high();
+      m_enabled = true;
+      m_bus.write(msg.getBuffer(), msg.getLength());
+    }
+
+    Stream &m_bus;
+    EnablePin m_enable_pin;
+    unsigned long m_frame_us;
+    Timeout<MillisClock> m_beacon;
+    bool m_enabled = false;
+    unsigned long m_idle_at = 0;  // in micros
+};
+
+template <typename EnablePin>
+ShowMaster<EnablePin> make_ShowMaster(
+  Stream &bus, EnablePin enable_pin, unsigned long baud,
+  ShowLink::RunHandler run = nullptr, ShowLink::StopHandler stop = nullptr
+) {
+  return ShowMaster<EnablePin>(bus, enable_pin, baud, run, stop);
+}
+
+class ShowNode : public ShowLink {
+  public:
+    explicit ShowNode(Stream &bus, RunHandler run = nullptr, StopHandler stop = nullptr) :
+      ShowLink(run, stop), m_bus(bus) {}
+
+    // Call every millisecond or so.  The clock is only as good as the
+    // time between a frame's arrival and this noticing it.
+    void update() {
+      uint8_t budget = 16;  // bytes per call, so one call stays short
+      while (budget-- > 0 && m_bus.available() > 0) {
+        if (!m_msg.receive(m_bus.read())) continue;
+        if (!m_msg.isValid()) { ++m_errors; continue; }
+        handle();
+      }
+      checkCue();
+    }
+
+    bool synced() const { return m_synced; }
+    unsigned long beacons() const { return m_beacons; }
+    // The number of frames that failed their checksums.
+    unsigned errors() const { return m_errors; }
+
+  private:
+    void handle() {
+      switch (m_msg.getMessageID()) {
+        case NET_SYNC: {
+          const unsigned long bits =
+            (static_cast<unsigned long>(m_msg.getExtra()) << 16) | m_msg.getParam();
+          const auto master = shownet::unwrap(ShowClock::now(), bits, 24);
+          ShowClock::offset() += static_cast<long>(master - ShowClock::now());
+          m_synced = true;
+          ++m_beacons;
+          break;
+        }
+        case NET_RUN:
+          if (m_synced) {
+            cue(m_msg.getExtra(), shownet::unwrap(ShowClock::now(), m_msg.getParam(), 16));
+          }
+          break;
+        case NET_STOP:
+          cancel();
+          break;
+        default: break;
+      }
+    }
+
+    Stream &m_bus;
+    NetMessage m_msg;
+    bool m_synced = false;
+    unsigned long m_beacons = 0;
+    unsigned m_errors = 0;
+};
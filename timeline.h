@@ -0,0 +1,166 @@
+// Show timelines: cues for audio, fog, and lights, played from PROGMEM
+
+// A show is a table of cues in program memory, each stamped with its
+// time in milliseconds from the start of the show:
+//
+//     const Cue scene1[] PROGMEM = {
+//       cuePlay(    0, 2, 5),     // folder 2, track 5
+//       cueFog(  1200, 3000),     // 3 seconds of fog
+//       cueLights(1500, 0b11),    // lightning...
+//       cueLights(1600, 0b00),    // ...and dark again
+//       cueEnd(  8000)
+//     };
+//     const Cue *const shows[] PROGMEM = { scene1 };
+//
+// Effects fired one at a time by text commands drift with the link's
+// latency, but the cues of a show are timed against its own start, so the
+// fog and lights stay where they belong relative to the audio.  Each cue's
+// deadline is computed from the show's start rather than from the previous
+// cue, so a late cue doesn't push back the ones after it.
+//
+// Nothing is allocated or parsed at run time: the Timeline just keeps a
+// pointer to the next cue and a Timeout for it.  Call `update` from a
+// scheduler task every millisecond or so.  Cues with the same time are
+// performed in the order they're listed.
+//
+// A REMOTE cue starts a show on other props.  With a show network (see
+// shownet.h), they start it 50 ms after the cue, so put the cue that much
+// ahead of where their part belongs.
+//
+// A show's clock starts when `run` is called, not when the audio starts.
+// The audio module takes one command at a time (see audiomodule.h), so if
+// it's still working through earlier commands, a PLAY cue waits its turn
+// and the cues after it run ahead of the audio by that much.  Start shows
+// while the module is idle.
+//
+// Stopping a show, or starting another over it, turns the lights off,
+// since it may not have reached the cue that turns them off.
+//
+// Times are 16 bits, so a show can last up to about 65 seconds.
+
+#pragma once
+
+#include "audiomodule.h"
+#include "fogger.h"
+#include "timeout.h"
+
+struct Cue {
+  enum Action : uint8_t { END, PLAY_FILE, PLAY_TRACK, STOP, VOLUME, FOG, LIGHTS, REMOTE };
+  uint16_t at;  // milliseconds from the start of the show
+  Action action;
+  uint8_t arg8;
+  uint16_t arg16;
+};
+
+constexpr Cue cuePlay(uint16_t at, uint8_t folder, uint16_t track) {
+  return Cue{at, Cue::PLAY_TRACK, folder, track};
+}
+constexpr Cue cuePlayFile(uint16_t at, uint16_t file_index) {
+  return Cue{at, Cue::PLAY_FILE, 0, file_index};
+}
+constexpr Cue cueStop(uint16_t at) { return Cue{at, Cue::STOP, 0, 0}; }
+constexpr Cue cueVolume(uint16_t at, uint8_t volume) {
+  return Cue{at, Cue::VOLUME, volume, 0};
+}
+constexpr Cue cueFog(uint16_t at, uint16_t duration_ms) {
+  return Cue{at, Cue::FOG, 0, duration_ms};
+}
+// Sets every light at once: bit i of `lights` turns on light i.
+constexpr Cue cueLights(uint16_t at, uint8_t lights) {
+  return Cue{at, Cue::LIGHTS, lights, 0};
+}
+// Starts show `show` on the other props.
+constexpr Cue cueRemote(uint16_t at, uint8_t show) {
+  return Cue{at, Cue::REMOTE, show, 0};
+}
+// Marks the end of the show, which matters for `running`.
+constexpr Cue cueEnd(uint16_t at) { return Cue{at, Cue::END, 0, 0}; }
+
+class Timeline {
+  public:
+    using MyAudioModule = BasicAudioModule;
+    typedef void (*LightHandler)(uint8_t lights);
+    typedef void (*RemoteHandler)(uint8_t show);
+
+    // `shows` is a PROGMEM table of pointers to END-terminated cue tables.
+    // `set_lights`, if provided, is called for LIGHTS cues, and
+    // `run_remote` for REMOTE cues.
+    template <size_t N>
+    Timeline(
+      const Cue *const (&shows)[N],
+      MyAudioModule &audio,
+      FogMachine *fogger = nullptr,
+      LightHandler set_lights = nullptr,
+      RemoteHandler run_remote = nullptr
+    ) :
+      m_shows(shows), m_show_count(N), m_audio(audio), m_fogger(fogger),
+      m_set_lights(set_lights), m_run_remote(run_remote) {}
+
+    // Starts show `number` (counting from 1, like files), abandoning any
+    // show that's already running.  Returns false if there's no such show.
+    bool run(unsigned number) {
+      if (number == 0 || number > m_show_count) return false;
+      stop();
+      m_next = reinterpret_cast<const Cue *>(pgm_read_ptr(&m_shows[number - 1]));
+      m_start = MicrosClock::now();
+      schedule();
+      return true;
+    }
+
+    void stop() {
+      if (running() && m_set_lights) m_set_lights(0);
+      m_next = nullptr;
+      m_timeout.cancel();
+    }
+
+    bool running() const { return m_next != nullptr; }
+
+    // Performs every cue that's due.
+    void update() {
+      while (running() && m_timeout.expired()) {
+        Cue cue;
+        memcpy_P(&cue, m_next, sizeof(cue));
+        if (cue.action == Cue::END) { stop(); return; }
+        perform(cue);
+        ++m_next;
+        schedule();
+      }
+    }
+
+  private:
+    void schedule() {
+      const auto at = static_cast<unsigned long>(pgm_read_word(&m_next->at)) * 1000;
+      const auto elapsed = MicrosClock::now() - m_start;
+      // A cue that's already late is due now.
+      m_timeout.set(elapsed < at ? at - elapsed : 0);
+    }
+
+    void perform(const Cue &cue) {
+      switch (cue.action) {
+        case Cue::PLAY_FILE:  m_audio.playFile(cue.arg16); break;
+        case Cue::PLAY_TRACK: m_audio.playTrack(cue.arg8, cue.arg16); break;
+        case Cue::STOP:       m_audio.stop(); break;
+        case Cue::VOLUME:     m_audio.setVolume(cue.arg8); break;
+        case Cue::FOG:
+          if (m_fogger) m_fogger->on(cue.arg16);
+          break;
+        case Cue::LIGHTS:
+          if (m_set_lights) m_set_lights(cue.arg8);
+          break;
+        case Cue::REMOTE:
+          if (m_run_remote) m_run_remote(cue.arg8);
+          break;
+        default: break;
+      }
+    }
+
+    const Cue *const *m_shows;
+    uint8_t m_show_count;
+    MyAudioModule &m_audio;
+    FogMachine *m_fogger;
+    LightHandler m_set_lights;
+    RemoteHandler m_run_remote;
+    const Cue *m_next = nullptr;
+    unsigned long m_start = 0;
+    Timeout<MicrosClock> m_timeout;
+};
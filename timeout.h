@@ -1,3 +1,5 @@
+#pragma once
+
 #include <limits.h>
 
 struct MillisClock { static decltype(millis()) now() { return millis(); } };
@@ -16,15 +18,12 @@ class Timeout {
 
     bool expired() const {
       if (m_expires == 0) return false;
-      const auto now = Clock::now();
-      if (now < m_expires) return false;
-      // It looks like the timer had expired, but we have to
-      // check for rollover first.  If MSB of m_expires is 0
-      // and the MSB of now is 1, then we need to wait for the
-      // clock to roll over.  The conditions above mean we
-      // already know now >= m_expires, so this boils down to
-      // whether the MSBs are different, thus the exclusive-or.
-      return !((now ^ m_expires) & MSB_MASK);
+      // The difference wraps around along with the clock, so as long
+      // as `delta` was less than half the range, its MSB is set only
+      // while the expiration is still ahead of us.  That holds across
+      // rollover and across the midpoint alike.
+      const TimeRep since = Clock::now() - m_expires;
+      return !(since & MSB_MASK);
     }
     
     // `delta` must be less than half of the range of a TimeRep.
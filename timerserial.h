@@ -0,0 +1,214 @@
+// Software serial ports clocked by Timer2
+
+// SoftwareSerial bit-bangs each byte with interrupts disabled, so every
+// byte sent at 9600 baud stalls the processor for about a millisecond.
+// Bytes arriving on another port in the meantime are lost, and only one
+// SoftwareSerial port can listen at a time anyway.
+//
+// A TimerSerial port sends and receives one bit per interrupt instead.
+// Timer2 runs in CTC mode with a period of one bit, and its compare-match
+// A interrupt shifts out the next bit for every port.  The receiver waits
+// for a start bit with a pin-change interrupt, and then sets compare-match
+// B to land in the middle of each bit, so the bits are sampled where
+// they're most stable.  While a port is idle, the bit clock interrupt
+// just checks whether there's anything to send.
+//
+// All the ports share the bit clock, so they must use the same baud rate.
+// Any number of ports can transmit, but only one can receive.  A port
+// constructed without an RX pin is transmit-only, which suits a display.
+//
+// The sketch owns the interrupt vectors, so it routes them to the ports:
+//
+//     TimerSerial<10, 11> audio_port;  // TX on 10, RX on 11
+//     TimerSerial<A3> lcd_port;        // TX only
+//     ISR(TIMER2_COMPA_vect) { audio_port.onBitClock(); lcd_port.onBitClock(); }
+//     ISR(TIMER2_COMPB_vect) { audio_port.onSample(); }
+//     ISR(PCINT0_vect) { audio_port.onEdge(); }  // pins 8-13
+//
+// The pin-change vector depends on the RX pin: PCINT2_vect for pins 0-7,
+// PCINT0_vect for 8-13, and PCINT1_vect for A0-A5.  This can't share a
+// sketch with SoftwareSerial, which defines all three.
+
+#pragma once
+
+#include "fastpin.h"
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+namespace timerserial {
+  // Starts Timer2 ticking once per bit, unless a port already has.  This
+  // takes Timer2 away from analogWrite on pins 3 and 11.
+  inline void startBitClock(unsigned long baud) {
+    static bool running = false;
+    if (running) return;
+    running = true;
+    unsigned long ticks = F_CPU / 8 / baud;
+    uint8_t prescaler = bit(CS21);  // clk/8
+    if (ticks > 256) {
+      ticks /= 4;
+      prescaler = bit(CS21) | bit(CS20);  // clk/32
+    }
+    TCCR2A = bit(WGM21);
+    TCCR2B = prescaler;
+    OCR2A = ticks - 1;
+    TCNT2 = 0;
+    TIFR2 = bit(OCF2A);
+    TIMSK2 |= bit(OCIE2A);
+  }
+
+  inline volatile uint8_t &pcmsk(int pin) {
+    return pin < 8 ? PCMSK2 : pin < 14 ? PCMSK0 : PCMSK1;
+  }
+
+  constexpr uint8_t pcieBit(int pin) {
+    return pin < 8 ? PCIE2 : pin < 14 ? PCIE0 : PCIE1;
+  }
+}
+
+template <int TX_PIN, int RX_PIN = -1, uint8_t TX_SIZE = 16, uint8_t RX_SIZE = 32>
+class TimerSerial : public Stream {
+  public:
+    static_assert((TX_SIZE & (TX_SIZE - 1)) == 0, "TX_SIZE must be a power of 2");
+    static_assert((RX_SIZE & (RX_SIZE - 1)) == 0, "RX_SIZE must be a power of 2");
+
+    void begin(unsigned long baud) {
+      Tx::high();  // idle
+      Tx::output();
+      if (HAS_RX) {
+        Rx::inputPullup();
+        timerserial::pcmsk(RX) |= fastpin::maskOf(RX);
+        PCICR |= bit(timerserial::pcieBit(RX));
+      }
+      timerserial::startBitClock(baud);
+    }
+
+    explicit operator bool() const { return true; }
+
+    int available() override {
+      return (m_rx_tail - m_rx_head) & RX_MASK;
+    }
+
+    int read() override {
+      if (m_rx_head == m_rx_tail) return -1;
+      const uint8_t b = m_rx_buffer[m_rx_head];
+      m_rx_head = (m_rx_head + 1) & RX_MASK;
+      return b;
+    }
+
+    int peek() override {
+      return m_rx_head == m_rx_tail ? -1 : m_rx_buffer[m_rx_head];
+    }
+
+    // Like HardwareSerial, this waits if the transmit buffer is full.
+    size_t write(uint8_t b) override {
+      const uint8_t next = (m_tx_tail + 1) & TX_MASK;
+      while (next == m_tx_head) {}
+      m_tx_buffer[m_tx_tail] = b;
+      m_tx_tail = next;
+      return 1;
+    }
+
+    using Print::write;
+
+    int availableForWrite() override {
+      return (m_tx_head - m_tx_tail - 1) & TX_MASK;
+    }
+
+    // Waits until everything has been sent.
+    void flush() override {
+      while (m_tx_head != m_tx_tail || m_tx_bit != 0) {}
+    }
+
+    // The number of bytes dropped because the receive buffer was full or
+    // the stop bit was missing.
+    unsigned errors() const { return m_errors; }
+
+    // Call from TIMER2_COMPA_vect.
+    void onBitClock() {
+      switch (m_tx_bit) {
+        case 0:
+          if (m_tx_head == m_tx_tail) return;
+          m_tx_byte = m_tx_buffer[m_tx_head];
+          m_tx_head = (m_tx_head + 1) & TX_MASK;
+          Tx::low();  // start bit
+          break;
+        case 9:
+          Tx::high();  // stop bit
+          m_tx_bit = 0;
+          return;
+        default:
+          Tx::write(m_tx_byte & 1);
+          m_tx_byte >>= 1;
+          break;
+      }
+      ++m_tx_bit;
+    }
+
+    // Call from the pin-change vector for RX_PIN.
+    void onEdge() {
+      if (!HAS_RX || Rx::read()) return;  // only a falling edge starts a byte
+      // Aim for the middle of the start bit, half a period from now.
+      const uint8_t top = OCR2A;
+      uint16_t sample = TCNT2 + (top + 1) / 2;
+      if (sample > top) sample -= top + 1;
+      OCR2B = sample;
+      TIFR2 = bit(OCF2B);
+      TIMSK2 |= bit(OCIE2B);
+      timerserial::pcmsk(RX) &= ~fastpin::maskOf(RX);
+      m_rx_bit = 0;
+    }
+
+    // Call from TIMER2_COMPB_vect.
+    void onSample() {
+      if (!HAS_RX) return;
+      const bool level = Rx::read();
+      if (m_rx_bit == 0) {
+        // A glitch rather than a start bit.
+        if (level) return listen();
+      } else if (m_rx_bit <= 8) {
+        m_rx_byte = (m_rx_byte >> 1) | (level ? 0x80 : 0);
+      } else {
+        const uint8_t next = (m_rx_tail + 1) & RX_MASK;
+        if (level && next != m_rx_head) {
+          m_rx_buffer[m_rx_tail] = m_rx_byte;
+          m_rx_tail = next;
+        } else {
+          ++m_errors;
+        }
+        return listen();
+      }
+      ++m_rx_bit;
+    }
+
+  private:
+    static constexpr bool HAS_RX = RX_PIN >= 0;
+    // A transmit-only port never touches its RX pin, but the code still
+    // has to compile, so this stands in.
+    static constexpr int RX = HAS_RX ? RX_PIN : TX_PIN;
+    static constexpr uint8_t TX_MASK = TX_SIZE - 1;
+    static constexpr uint8_t RX_MASK = RX_SIZE - 1;
+    typedef FastPin<TX_PIN> Tx;
+    typedef FastPin<RX> Rx;
+
+    // Stops sampling and waits for the next start bit.
+    void listen() {
+      TIMSK2 &= ~bit(OCIE2B);
+      PCIFR = bit(timerserial::pcieBit(RX));
+      timerserial::pcmsk(RX) |= fastpin::maskOf(RX);
+    }
+
+    uint8_t m_tx_buffer[TX_SIZE];
+    volatile uint8_t m_tx_head = 0;
+    volatile uint8_t m_tx_tail = 0;
+    volatile uint8_t m_tx_bit = 0;  // 0 between bytes, 1 to 9 while sending
+    uint8_t m_tx_byte = 0;
+
+    uint8_t m_rx_buffer[HAS_RX ? RX_SIZE : 1];
+    volatile uint8_t m_rx_head = 0;
+    volatile uint8_t m_rx_tail = 0;
+    uint8_t m_rx_bit = 0;
+    uint8_t m_rx_byte = 0;
+    volatile unsigned m_errors = 0;
+};
+
+#endif
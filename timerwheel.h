@@ -0,0 +1,169 @@
+// A hierarchical timer wheel
+
+// Instead of every object keeping its own deadline and comparing it with
+// millis() on every pass through `loop`, objects start Timers on a shared
+// TimerWheel, which calls them back when they expire:
+//
+//     TimerWheel timers;
+//     Timer lockout;
+//     void endLockout(void *) { state = State::waiting; }
+//     ...
+//     timers.start(lockout, 30000, endLockout);
+//     ...
+//     void loop() { timers.update(); }
+//
+// The wheel keeps a tick count of milliseconds and a few levels of slots.
+// Level 0 has a slot for each of the next 16 ticks, level 1 a slot for
+// each of the next 16 blocks of 16 ticks, and so on.  Starting a timer
+// just links it into the slot for its expiration, and each tick looks at
+// exactly one slot of level 0, so the cost doesn't grow with the number
+// of timers.  Every 16 ticks, the next slot of level 1 is redistributed
+// into level 0, and likewise up the levels.
+//
+// The ticks are an unsigned count that wraps around with millis(), and
+// a timer's place is always worked out from its distance ahead of the
+// current tick, so there's nothing to go wrong at rollover.  The five
+// levels reach about 17 minutes ahead.  A longer timer waits in the last
+// slot of the top level and is placed again each time that comes around.
+// A delay must be less than about 24 days.
+//
+// Timers are intrusive, so nothing is allocated.  A Timer must outlive
+// its wheel or be cancelled, and it must not be copied while it's
+// running.  Callbacks run from `update`, and they may start or cancel any
+// timer, including their own.
+
+#pragma once
+
+class Timer {
+  public:
+    typedef void (*Callback)(void *context);
+
+    Timer() = default;
+
+    bool running() const { return m_link != nullptr; }
+
+  private:
+    friend class TimerWheel;
+
+    Timer *m_next = nullptr;
+    Timer **m_link = nullptr;  // whatever points to this one, while running
+    unsigned long m_expires = 0;
+    Callback m_callback = nullptr;
+    void *m_context = nullptr;
+};
+
+class TimerWheel {
+  public:
+    static constexpr uint8_t SLOT_BITS = 4;
+    static constexpr uint8_t SLOTS = 1 << SLOT_BITS;
+    static constexpr uint8_t LEVELS = 5;
+
+    TimerWheel() : m_now(millis()) {
+      for (auto &level : m_slots) {
+        for (auto &slot : level) slot = nullptr;
+      }
+    }
+
+    // (Re)starts `timer` to call `callback(context)` after `delay`
+    // milliseconds.  Without a callback, the timer just stops running.
+    void start(Timer &timer, unsigned long delay, Timer::Callback callback = nullptr, void *context = nullptr) {
+      cancel(timer);
+      timer.m_expires = millis() + delay;
+      timer.m_callback = callback;
+      timer.m_context = context;
+      insert(timer);
+    }
+
+    void cancel(Timer &timer) {
+      if (!timer.running()) return;
+      *timer.m_link = timer.m_next;
+      if (timer.m_next) timer.m_next->m_link = timer.m_link;
+      timer.m_next = nullptr;
+      timer.m_link = nullptr;
+    }
+
+    // Milliseconds until `timer` expires, or 0 if it isn't running.
+    unsigned long remaining(const Timer &timer) const {
+      if (!timer.running()) return 0;
+      const long left = timer.m_expires - millis();
+      return left > 0 ? left : 0;
+    }
+
+    // Calls back every timer that has expired.  Call every millisecond or
+    // so; if it's late, it works through each tick it missed.
+    void update() {
+      const auto now = millis();
+      while (static_cast<long>(now - m_now) >= 0) {
+        const uint8_t index = m_now & MASK;
+        if (index == 0) cascade(1);
+        Timer *list = detach(m_slots[0][index]);
+        // On to the next tick before the callbacks, so a timer they start
+        // can't land in the slot that's being emptied.
+        ++m_now;
+        expire(list);
+      }
+    }
+
+  private:
+    static constexpr uint8_t MASK = SLOTS - 1;
+    static constexpr unsigned long RANGE = 1ul << (SLOT_BITS * LEVELS);
+
+    void insert(Timer &timer) {
+      unsigned long delta = timer.m_expires - m_now;
+      // Already due (or started within the tick being processed).
+      if (static_cast<long>(delta) < 0) delta = 0;
+      // Too far out for the top level, so it waits in the top level's
+      // last slot and gets placed again when that's redistributed.
+      if (delta >= RANGE) delta = RANGE - 1;
+      const unsigned long at = m_now + delta;
+      uint8_t level = 0;
+      while (level < LEVELS - 1 && delta >= (1ul << (SLOT_BITS * (level + 1)))) ++level;
+      push(m_slots[level][(at >> (SLOT_BITS * level)) & MASK], timer);
+    }
+
+    static void push(Timer *&head, Timer &timer) {
+      timer.m_next = head;
+      timer.m_link = &head;
+      if (head) head->m_link = &timer.m_next;
+      head = &timer;
+    }
+
+    // Moves the timers in the current slot of `level` down to where they
+    // belong now, starting with the level above if this slot is the
+    // first.
+    void cascade(uint8_t level) {
+      const uint8_t index = (m_now >> (SLOT_BITS * level)) & MASK;
+      Timer *list = detach(m_slots[level][index]);
+      while (list) {
+        Timer &timer = *list;
+        list = timer.m_next;
+        if (list) list->m_link = &list;
+        timer.m_link = nullptr;
+        insert(timer);
+      }
+      if (index == 0 && level + 1 < LEVELS) cascade(level + 1);
+    }
+
+    static void expire(Timer *list) {
+      // Callbacks may cancel timers that are still in the detached list,
+      // so the list stays properly linked while we walk it.
+      if (list) list->m_link = &list;
+      while (list) {
+        Timer &timer = *list;
+        list = timer.m_next;
+        if (list) list->m_link = &list;
+        timer.m_next = nullptr;
+        timer.m_link = nullptr;
+        if (timer.m_callback) timer.m_callback(timer.m_context);
+      }
+    }
+
+    static Timer *detach(Timer *&slot) {
+      Timer *list = slot;
+      slot = nullptr;
+      return list;
+    }
+
+    Timer *m_slots[LEVELS][SLOTS];
+    unsigned long m_now;  // the next tick to process
+};